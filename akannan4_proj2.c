@@ -16,42 +16,14 @@
 #include <netdb.h>
 #include <getopt.h>
 #include <limits.h> // for USHRT_MAX definition
+#include <ctype.h>
+#include <unistd.h>
+#include <time.h>
+#include <math.h>
 
+#include "router.h"
 
-/* data structure for routing table */
- struct server{
-	uint32_t server_ip;
-	uint16_t server_id;
-	uint16_t server_port;
-	uint16_t cost;
-
-	int is_neighbor;
-	int num_of_skips;
-	int is_alive;
-	int next_hop;
-};
-
-/* data struture for update message */
-/* distance vector format */
- struct  distance_vector {
-	uint32_t server_ip; 
-	uint16_t server_port;
-	uint16_t padding; 
-	uint16_t server_id; 
-	uint16_t cost; 
-} ;
-
-
-
-/* routing packet format */
- struct routing_update_pkt{
-	uint16_t num_of_updates; 
-	uint16_t sender_port; 
-	uint32_t sender_ip; 
-	struct distance_vector* updates; 
-} ;
-
-int ** adj_matrix;
+metric_t ** adj_matrix;
 
 int my_port;
 int num_of_servers;
@@ -59,78 +31,127 @@ uint32_t my_ip;
 char * my_ip_raw;
 
 int my_id;
-int my_socket;
+int my_index; // of my_id in servers
+int my_socket=-1; // -1 until bound, nothing is sent without it
+
+/* hierarchical areas: servers holds my area, my neighbors and then one entry per remote area, sorted by area */
+int areas_enabled=0;
+uint16_t my_area=0;
+int first_area_index; // num_of_servers when areas are off
+int *advertised; // indexes of the entries a vector carries, in servers order
+int num_of_advertised;
+int *index_table=NULL; // open addressing server ID -> index, areas_enabled only
+int index_table_mask;
+
+/* self identity, resolved without network access */
+int requested_id=0; // --id
+char * bind_ip=NULL; // --bind
+uint32_t local_ips[MAX_LOCAL_IPS]; // network order
+int num_of_local_ips=0;
 struct server *servers;
 
 int cmdNo;
 char** parsedCommand;
-char* commands[11] = {"update","step","packets","display","disable","crash"};
+#define NUM_OF_COMMANDS 10
+char* commands[11] = {"update","step","packets","display","disable","crash","fib","lookup","whatif","restart"};
 
 int num_of_pkts_received=0;
 
 char response_message[100];
+int quiet=0; // no per packet output, set by tools
+metric_t metric_infinity=METRIC_MAX; // -m, costs this high are unreachable
+int compact_updates=1; // advertise and send PKT_COMPACT updates, -l turns it off
+int unchanged_keepalives=1; // periodic updates of an unchanged vector go out as PKT_UNCHANGED, -l turns it off
+uint32_t vector_version=1; // of my vector, bumped by update_vector_version()
+uint64_t last_vector_hash=0;
+long long restart_window_ms=0; // set by the restart command, announced in TLV_RESTART
+long long reliable_rto_ms=RELIABLE_RTO_MS; // -r, 0 sends triggered updates unacked
+long long next_retransmit_ms=0; // earliest retransmit timer, 0 if nothing is in flight
+long long next_ack_ms=0; // when the scheduled acks go out, 0 if none are
+
+FILE * capture_file=NULL; // -c, trace of every received datagram
+uint32_t event_cause=0; // event being handled, the cause of events it leads to; -e turns tracing on
+uint32_t triggered_cause=0; // event that scheduled the pending triggered update
+int entries_changed; // distance vector entries changed by the packet being processed
+uint32_t rx_dropped=0; // datagrams dropped by the kernel on my_socket (SO_RXQ_OVFL)
+uint32_t rx_dropped_reported=0;
+
+struct fib fib; // forwarding table built from advertised prefixes
+char* own_prefixes[MAX_OWN_PREFIXES]; // -p arguments
+int num_of_own_prefixes=0;
+
+/* update scheduling */
+long long base_interval_ms; // -i
+long long current_interval_ms; // grows while routes are stable
+int jitter_percent=DEFAULT_JITTER_PERCENT; // -j
+int max_backoff=DEFAULT_MAX_BACKOFF; // -b, multiple of base_interval_ms
+long long hold_down_ms=DEFAULT_HOLD_DOWN_MS; // -w
+long long next_periodic_ms;
+long long next_tick_ms; // dead neighbor check and stats report, every base_interval_ms
+int triggered_pending=0;
+long long triggered_due_ms;
+int routes_changed=0; // since the last periodic update
+long long hello_interval_ms=0; // -H, 0 disables hellos
+long long next_hello_ms;
+
+struct update_stats interval_stats;
+struct update_stats total_stats;
+
+/* route flap damping, off unless -d is given */
+double damp_half_life_ms=0;
+unsigned long recomputes_avoided=0;
+unsigned long sends_avoided=0;
+unsigned long suppress_events=0;
+
+unsigned long lfa_failovers=0; // routes moved to their loop-free alternate on a neighbor failure
+
 
 
 
 /*
 *
-*	Stores the host's IP Address in the global variable 'my_ip_raw'
+*	Stores the IPv4 addresses of the host's interfaces in 'local_ips', for is_me() to
+*	find this server's entry when neither --id nor --bind is given. Reads them with
+*	getifaddrs() so startup needs no network access.
 *
 *	@return 
 *		Integer indicating success/failure of function
 *
-*	Source: http://jhshi.me/2013/11/02/how-to-get-hosts-ip-address/
-*
 */
-int get_my_ip_address(){
-	
-	char* target_name = "8.8.8.8";
-    char* target_port = "53";
-
-    struct addrinfo hints;
-    memset(&hints, 0, sizeof(hints));
-    hints.ai_family = AF_INET;
-    hints.ai_socktype = SOCK_STREAM;
-
-    struct addrinfo* info;
-    int ret = 0;
-    if ((ret = getaddrinfo(target_name, target_port, &hints, &info)) != 0) {
-        printf("[ERROR]: getaddrinfo error: %s\n", gai_strerror(ret));
-        return -1;
-    }
-
-    if (info->ai_family == AF_INET6) {
-        printf("[ERROR]: do not support IPv6 yet.\n");
-        return -1;
-    }
+int read_local_ips(){
+	struct ifaddrs *interfaces,*ifa;
 
-    int sock = socket(info->ai_family, info->ai_socktype, info->ai_protocol);
-    if (sock <= 0) {
-        perror("socket");
-        return -1;
-    }
-
-    if (connect(sock, info->ai_addr, info->ai_addrlen) < 0) {
-        perror("connect");
-        close(sock);
-        return -1;
-    }
+	if(getifaddrs(&interfaces)<0){
+		perror("getifaddrs");
+		return -1;
+	}
 
-    struct sockaddr_in local_addr;
-    socklen_t addr_len = sizeof(local_addr);
-    if (getsockname(sock, (struct sockaddr*)&local_addr, &addr_len) < 0) {
-        perror("getsockname");
-        close(sock);
-        return -1;
-    }
+	num_of_local_ips=0;
+	for(ifa=interfaces;ifa!=NULL && num_of_local_ips<MAX_LOCAL_IPS;ifa=ifa->ifa_next){
+		if(ifa->ifa_addr==NULL || ifa->ifa_addr->sa_family!=AF_INET)
+			continue;
+		local_ips[num_of_local_ips++]=((struct sockaddr_in*)ifa->ifa_addr)->sin_addr.s_addr;
+	}
 
-    char * myip=(char*) malloc(sizeof(char)*INET6_ADDRSTRLEN);
-    if (inet_ntop(local_addr.sin_family, &(local_addr.sin_addr), myip, INET6_ADDRSTRLEN) == NULL) {
-        perror("inet_ntop");
-        return -1;
-    }
+	freeifaddrs(interfaces);
+	return 1;
+}
 
-    my_ip_raw=myip;
+/*
+*
+*	Checks if an address belongs to one of the host's interfaces
+*
+*	@param ip
+*		IPv4 address in network order
+*
+*/
+int is_local_ip(uint32_t ip){
+	int i;
+	for(i=0;i<num_of_local_ips;i++){
+		if(local_ips[i]==ip)
+			return 1;
+	}
+	return 0;
 }
 
 
@@ -141,8 +162,94 @@ int get_my_ip_address(){
 */
 
 void reset_skip_flag(int server_id){
-	servers[server_id-1].num_of_skips=0;
+	servers[server_index(server_id)].num_of_skips=0;
+
+}
+
+/*
+*
+*	Sets a single next hop for a server, dropping any equal cost alternatives
+*
+*	@param index
+*		Index of the destination in servers
+*
+*	@param hop
+*		Next hop server ID, my_id if directly connected, -1 if unreachable
+*
+*/
+void set_next_hop(int index,int hop){
+	servers[index].next_hop=hop;
+	servers[index].num_of_next_hops=0;
+	if(hop==-1)
+		return;
+	servers[index].next_hops[0]=(hop==my_id) ? servers[index].server_id : hop; // sets hold the neighbor to forward to
+	servers[index].num_of_next_hops=1;
+}
+
+/*
+*
+*	Stores the equal cost next hops found by bellman_ford(), keeping next_hop as the first entry
+*
+*	@param index
+*		Index of the destination in servers
+*
+*	@param hops
+*		Equal cost next hop server IDs
+*
+*	@param count
+*		Number of entries in hops
+*
+*/
+void store_next_hops(int index,uint16_t *hops,int count){
+	int i,primary;
+
+	if(count==0 || servers[index].cost==metric_infinity){ // no path found in this pass, keep the previous next hop
+		set_next_hop(index,servers[index].cost==metric_infinity ? -1 : servers[index].next_hop);
+		return;
+	}
+
+	primary=servers[index].next_hop==my_id ? servers[index].server_id : servers[index].next_hop;
+	for(i=0;i<count;i++){
+		if(hops[i]==primary)
+			break;
+	}
+	if(i==count){ // previous next hop is not among the cheapest any more
+		primary=hops[0];
+		servers[index].next_hop=primary;
+	}
+
+	servers[index].next_hops[0]=primary;
+	servers[index].num_of_next_hops=1;
+	for(i=0;i<count;i++){
+		if(hops[i]!=primary && servers[index].num_of_next_hops<ECMP_MAX_PATHS)
+			servers[index].next_hops[servers[index].num_of_next_hops++]=hops[i];
+	}
+}
 
+/*
+*
+*	Removes a neighbor from the next hop set of a server
+*
+*	@return
+*		1 if the server has no next hop left, 0 otherwise
+*
+*/
+int remove_next_hop(int index,int hop){
+	int i,j=0;
+
+	for(i=0;i<servers[index].num_of_next_hops;i++){
+		if(servers[index].next_hops[i]!=hop)
+			servers[index].next_hops[j++]=servers[index].next_hops[i];
+	}
+	if(j==servers[index].num_of_next_hops) // hop was not in the set
+		return j==0;
+	servers[index].num_of_next_hops=j;
+	if(j==0){
+		servers[index].next_hop=-1;
+		return 1;
+	}
+	servers[index].next_hop=servers[index].next_hops[0];
+	return 0;
 }
 
 /*
@@ -152,59 +259,114 @@ void reset_skip_flag(int server_id){
 */
 void bellman_ford(){ 
 	int i, j; 
-	uint16_t dist, min_dist; 
+	metric_t dist, min_dist; 
 	int src, dest,intermediate;
-	dist = USHRT_MAX; 
-	src = my_id-1;
+	uint16_t equal_hops[ECMP_MAX_PATHS]; // next hops with cost min_dist found in this pass
+	int num_of_equal;
+	metric_t old_cost;
+	int old_next_hop,changed=0,damped_changes=0,num_changed=0,penalty;
+	int64_t start_ns=event_tracing ? event_clock_ns() : 0;
+	uint32_t cause=event_cause;
+	static int *usable,usable_size; // neighbors a backup can go through
+	int num_of_usable=0;
+	dist = metric_infinity; 
+	src = my_index;
+
+	if(usable_size<num_of_servers){
+		free(usable);
+		usable=(int*)malloc(sizeof(int)*num_of_servers);
+		usable_size=num_of_servers;
+	}
+	for(j=0;j<num_of_servers;j++){
+		if(servers[j].is_neighbor && servers[j].is_alive && !servers[j].link_damp.suppressed && servers[j].link_cost<metric_infinity)
+			usable[num_of_usable++]=j;
+	}
 
 	/*find the least cost to the router from current router*/
 
 	for (i = 0; i < num_of_servers; i++){ 
 		dest = i; 
-       	if (src==dest) // if src and dest are same 
-       		continue;
+		if (src==dest) // if src and dest are same 
+			continue;
 		
-		min_dist = adj_matrix[src][dest];
+		min_dist = metric_infinity; // from scratch, so costs can go up as well as down
+		num_of_equal = 0;
+		old_cost = servers[dest].cost;
+		old_next_hop = servers[dest].next_hop;
 
 
 		for (j = 0; j < num_of_servers; j++){ 
 
 
 			intermediate = j;
-			if (adj_matrix[intermediate][dest] == USHRT_MAX) {// no path b/w intermediate and dest
-				if(servers[dest].next_hop==servers[intermediate].server_id){ // check if i originally reached dest through intermediate. if so, set cost to dest as INF
-					min_dist=USHRT_MAX; 
-					servers[dest].next_hop=-1;
-				}
-
+			if (adj_matrix[intermediate][dest] >= metric_infinity) // no path b/w intermediate and dest
 				continue;
-			}
 			// so there's a path between intermediate node and destination node
 			if(servers[intermediate].is_neighbor==0  ) // intermediate is not my neighbor 
 				continue;
 			// so intermediate is my neighbox
 			if(servers[intermediate].is_alive==0) // intermediate is dead to me
 				continue;
+			if(servers[intermediate].link_damp.suppressed) // link to intermediate is flapping
+				continue;
 
 			//so there's a path between intermediate and dest, intermediate is my neighbox and is alive
 
-			// new distance = cost to go to intermediate node + cost from intermediate to dest node
-			dist = adj_matrix[intermediate][dest] + servers[intermediate].cost; 
+			// new distance = cost of the link to intermediate node + cost from intermediate to dest node
+			dist = metric_add(adj_matrix[intermediate][dest], servers[intermediate].link_cost); // saturates instead of wrapping to a cheap route
 			
 			// if new dist is lesser than prev cost, make it min cost and first hop as intermediate node
 			if ((dist < min_dist) ){
 
 				min_dist = dist;
 				//printf("intermediate minimum cost %d\n",dist);
-				servers[dest].next_hop = servers[intermediate].server_id;  // to go to dest, first hop is intermediate node
+				equal_hops[0] = servers[intermediate].server_id;
+				num_of_equal = 1;
+			}
+			else if(dist == min_dist && dist < metric_infinity && num_of_equal < ECMP_MAX_PATHS){
+				equal_hops[num_of_equal++] = servers[intermediate].server_id;
 			}
 						
 		}
 		//printf("from %d to %d new minimum cost %d\n",src,dest,min_dist);
+		if(min_dist!=servers[dest].found_cost){ // flaps count on the route found, suppressed or not
+			if(min_dist==metric_infinity) // withdrawn
+				penalty=DAMP_DOWN_PENALTY;
+			else if(servers[dest].found_cost==metric_infinity && servers[dest].route_damp.penalty>0) // back after a withdrawal
+				penalty=DAMP_CHANGE_PENALTY;
+			else // learned for the first time, or another cost: not a flap
+				penalty=0;
+			if(penalty)
+				damp_event(&servers[dest].route_damp,penalty);
+			servers[dest].found_cost=min_dist;
+			if(servers[dest].route_damp.suppressed)
+				damped_changes=1;
+		}
+		if(servers[dest].route_damp.suppressed){ // neither used nor advertised until the penalty decays below DAMP_REUSE
+			min_dist=metric_infinity;
+			num_of_equal=0;
+		}
 		servers[dest].cost=min_dist;
 		adj_matrix[src][dest] = min_dist; 
+		store_next_hops(dest,equal_hops,num_of_equal);
+		servers[dest].backup=servers[dest].route_damp.suppressed ? -1 : find_backup(dest,usable,num_of_usable);
+		if(servers[dest].cost!=old_cost || servers[dest].next_hop!=old_next_hop){
+			num_changed++;
+			changed=1;
+		}
 
 	} 
+
+	refresh_fib();
+	if(event_tracing){
+		event_cause=changed ? event_next_id() : 0; // what the triggered update links back to
+		event_record(EVENT_RECOMPUTE,start_ns,num_changed,0,cause,event_cause);
+	}
+	if(changed)
+		note_route_change();
+	else if(damped_changes)
+		sends_avoided++; // a suppressed route flapped, nothing to advertise
+	event_cause=cause;
 			
 
 }
@@ -230,7 +392,7 @@ int parse(char* cmd){ // used in project 1
     
 
     int argsCount=0;
-    char** args = (char**) malloc(3*sizeof(char*));
+    char** args = (char**) malloc(8*sizeof(char*));
     int cmdNo=0;
 
     args[argsCount] = strtok(cmd," ");
@@ -244,7 +406,7 @@ int parse(char* cmd){ // used in project 1
     cmdLower[length]='\0';
 
     // check if command is valid
-    for(cmdNo=0;cmdNo<6;cmdNo++) {
+    for(cmdNo=0;cmdNo<NUM_OF_COMMANDS;cmdNo++) {
 
         if(strcmp(cmdLower,commands[cmdNo]) ==0) {
 
@@ -253,7 +415,7 @@ int parse(char* cmd){ // used in project 1
     }
     //printf("%s\n",args[argsCount]);
     //printf("%s\n",cmdLower);
-    if(cmdNo > 5) // Invalid command
+    if(cmdNo >= NUM_OF_COMMANDS) // Invalid command
     {
         printf("Invalid command \n");
         return -1;
@@ -278,6 +440,36 @@ int parse(char* cmd){ // used in project 1
         return -1;
     }
    }
+   if (cmdNo==7){
+        if (numberOfArgs==2)
+        return cmdNo;
+    else {
+        printf("Invalid command - Wrong Arguments \n");
+        printf("Usage: lookup <IP address>\n");
+
+        return -1;
+    }
+   }
+   if (cmdNo==8){
+        if (numberOfArgs==4)
+        return cmdNo;
+    else {
+        printf("Invalid command - Wrong Arguments \n");
+        printf("Usage: whatif <server-ID1> <server-ID2> <Link Cost>\n");
+
+        return -1;
+    }
+   }
+   if (cmdNo==9){
+        if (numberOfArgs<=2)
+        return cmdNo;
+    else {
+        printf("Invalid command - Wrong Arguments \n");
+        printf("Usage: restart [seconds]\n");
+
+        return -1;
+    }
+   }
    if (cmdNo==0){
         if (numberOfArgs==4)
         return cmdNo;
@@ -296,223 +488,1395 @@ int parse(char* cmd){ // used in project 1
 
 /*
 *
-*	Broadcasts distance vector to all neighbors
+*	Returns the update packet for neighbor i, encoding it into the round's buffers on first use
+*
+*	@param pkt
+*		Set to the packet, legacy_buf or compact_buf
+*
+*	@return
+*		Packet length
 *
 */
-void send_update_pkt(){
-	struct sockaddr_in dest_ip_struct; 
-	char ip_presentation[15];
-	int i;
-
-
-	for(i=0;i<num_of_servers;i++) {
-		inet_ntop(AF_INET,&servers[i].server_ip,ip_presentation,sizeof(ip_presentation));
-
-
-		if(servers[i].is_neighbor==1 && servers[i].is_alive==1){
-			//printf("Sending update packet to ID: %d IP: %s on %d\n",servers[i].server_id,ip_presentation,servers[i].server_port);
-
-			memset(&dest_ip_struct, 0, sizeof(struct sockaddr_in));
-
-			dest_ip_struct.sin_family = AF_INET;
-
-			//struct in_addr ip_struct;
-			//inet_aton(servers[i].server_ip, &ip_struct); 
-
-			dest_ip_struct.sin_addr.s_addr= servers[i].server_ip;
-			dest_ip_struct.sin_port = htons(servers[i].server_port); 
-			int MAX_PKT_SIZE=sizeof(struct routing_update_pkt)+(sizeof(struct distance_vector)*num_of_servers);
-
-			char send_buf[1000]; 
-			struct routing_update_pkt *packet_to_send;
-			packet_to_send=(struct routing_update_pkt *)malloc(sizeof(struct routing_update_pkt) + sizeof(struct distance_vector) * num_of_servers);
-			packet_to_send->updates=malloc(sizeof(struct distance_vector) * num_of_servers);
-
-			prepare_update_pkt(packet_to_send); // fills packet_to_send with routing information
-			serialize_packet(packet_to_send,&send_buf); 
-
-			if(sendto(my_socket, &send_buf, sizeof(send_buf), 0, &dest_ip_struct, sizeof(dest_ip_struct))<0){
-				perror("send");
-
-
-			}
-			else{
-				printf("Sent update packet to ID: %d IP: %s on %d\n",servers[i].server_id,ip_presentation,servers[i].server_port); //segfault
-						
+int update_pkt_for(int i,char *legacy_buf,int *legacy_len,char *compact_buf,int *compact_len,char **pkt){
+	if(*legacy_len==0 && *compact_len==0) // first packet of the round, TLV_VERSION has to match its contents
+		update_vector_version();
+	if(compact_updates && servers[i].peer_compact && servers[i].area==my_area){ // only my area lists the same entries
+		if(*compact_len==0)
+			*compact_len=serialize_compact_packet(compact_buf);
+		*pkt=compact_buf;
+		return *compact_len;
+	}
 
-			}
-				
+	if(*legacy_len==0){
+		struct routing_update_pkt *packet_to_send;
+		packet_to_send=(struct routing_update_pkt *)malloc(sizeof(struct routing_update_pkt) + sizeof(struct distance_vector) * num_of_servers);
+		packet_to_send->updates=malloc(sizeof(struct distance_vector) * num_of_servers);
 
-		}
+		prepare_update_pkt(packet_to_send); // fills packet_to_send with routing information
+		*legacy_len=serialize_packet(packet_to_send,legacy_buf);
+		free(packet_to_send->updates);
+		free(packet_to_send);
 	}
+	*pkt=legacy_buf;
+	return *legacy_len;
 }
 
-
 /*
 *
-*	Disables the link to a neighbor
-*
-*	@param server_id
-*		Neighbor ID whose link has to be disabled
+*	Sends a datagram to server index from my_socket. Without a socket, as when
+*	replaying a capture, nothing goes out and the send counts as done.
 *
-*	@return 
-*		Integer indicating success/failure of function
+*	@return
+*		What sendto() returns, len without a socket
 *
 */
-int disable(int server_id){
-	memset(response_message,0,sizeof(response_message));
-	if(server_id>num_of_servers){
-		sprintf(response_message, "Server %d is invalid", server_id);
-		return -1;
-
-	}
-	if(servers[server_id-1].is_neighbor==0){
-		sprintf(response_message, "Server %d is not a neighbor", server_id);
-		return -1;
-	}
-
-	
-	servers[server_id-1].is_neighbor=0;
-	servers[server_id-1].cost=USHRT_MAX;
-	servers[server_id-1].next_hop=-1;
-	adj_matrix[my_id-1][server_id-1]=USHRT_MAX;
-	adj_matrix[server_id-1][my_id-1]=USHRT_MAX;
-		
-
-	strcpy(response_message,"SUCCESS");
-	
-	return 1;
-	
+int send_to_server(int index,void *buf,int len){
+	struct sockaddr_in dest_ip_struct;
+
+	if(my_socket<0)
+		return len;
+	memset(&dest_ip_struct, 0, sizeof(struct sockaddr_in));
+	dest_ip_struct.sin_family = AF_INET;
+	dest_ip_struct.sin_addr.s_addr= servers[index].server_ip;
+	dest_ip_struct.sin_port = htons(servers[index].server_port);
+	return sendto(my_socket, buf, len, 0, (struct sockaddr*)&dest_ip_struct, sizeof(dest_ip_struct));
 }
 
-
 /*
 *
-*	Updates the link cost to a neighbor
-*
-*	@param from
-*		Source ID
-*
-*	@param to
-*		Destination ID
+*	Sends an update packet to neighbor i. A reliable send to a neighbor that acks
+*	gets the next sequence number in a TLV_SEQ, written over the packet's TLV_END,
+*	and is retransmitted until acked. When RELIABLE_WINDOW sends are in flight the
+*	update is deferred until an ack or the retransmit timer.
 *
-*	@param cost
-*		New cost
+*	@param pkt
+*		Packet ending in TLV_END with TLV_SEQ_SIZE spare bytes after it
 *
-*	@return 
+*	@return
 *		Integer indicating success/failure of function
 *
 */
-int update_link_cost(int from,int to,char* cost){
-	int i;
-	memset(response_message,0,sizeof(response_message));
-	int new_cost;
-	int inf_flag=0;
-	if(strcmp(cost,"inf")==0 || strcmp(cost,"INF")==0){
-		inf_flag=1;
-		new_cost=USHRT_MAX;
-
+int send_update_to(int i,char *pkt,int pkt_len,int reliable){
+	char ip_presentation[INET_ADDRSTRLEN];
+	uint16_t tlv_type=htons(TLV_SEQ),tlv_len=htons(4);
+	uint32_t seq;
+	int len=pkt_len,sent=1;
+
+	if(reliable_rto_ms==0 || !servers[i].peer_acks)
+		reliable=0;
+	if(reliable && servers[i].num_in_flight==RELIABLE_WINDOW){
+		servers[i].send_deferred=1;
+		return 0;
+	}
+	if(reliable){
+		seq=htonl(servers[i].next_seq);
+		memcpy(pkt+pkt_len-4,&tlv_type,2);
+		memcpy(pkt+pkt_len-2,&tlv_len,2);
+		memcpy(pkt+pkt_len,&seq,4);
+		memset(pkt+pkt_len+4,0,4); // TLV_END
+		len+=TLV_SEQ_SIZE;
 	}
-	else {
-		new_cost=atoi(cost);
 
+	if(send_to_server(i,pkt,len)<0){
+		perror("send");
+		sent=reliable=0;
 	}
-	if(from>num_of_servers){
-		sprintf(response_message, "Server %d is invalid", from);
-		return -1;
+	else{
+		interval_stats.pkts_sent++;
+		interval_stats.bytes_sent+=len;
+		servers[i].sent_version=vector_version;
+		if(!quiet){
+			inet_ntop(AF_INET,&servers[i].server_ip,ip_presentation,sizeof(ip_presentation));
+			printf("Sent update packet to ID: %d IP: %s on %d\n",servers[i].server_id,ip_presentation,servers[i].server_port);
+		}
 	}
-	if(to>num_of_servers){
-		sprintf(response_message, "Server %d is invalid", to);
-		return -1;
-	}	
-	if(from!=my_id && to!=my_id){
-		strcpy(response_message,"You can only change link cost of neighbors");
 
-		return -1;
+	if(len!=pkt_len)
+		memset(pkt+pkt_len-4,0,4); // back to plain TLV_END for the next neighbor
+	if(reliable){
+		servers[i].in_flight[servers[i].num_in_flight++]=servers[i].next_seq++;
+		servers[i].retransmits=0;
+		servers[i].retransmit_ms=now_ms()+reliable_rto_ms;
+		servers[i].send_deferred=0;
+		update_retransmit_timer();
 	}
-	if(from==to){
-		strcpy(response_message,"Self links are always 0. You cannot modify self links");
-		return -1;
-	}	
-	if(servers[to-1].is_neighbor==0){
-		sprintf(response_message, "Server %d is not a neighbor", to);
-
-		return -1;
-
-	}	
-
-	printf("%d %d %d\n",from,to,new_cost);
-	
-	adj_matrix[from-1][to-1]=new_cost;
-	adj_matrix[to-1][from-1]=new_cost;
-	servers[to-1].cost=new_cost;
-	servers[to-1].next_hop=from;
-
+	return sent ? 1 : -1;
+}
 
-	if(inf_flag==1){
-		servers[to-1].next_hop=-1;
+/*
+*
+*	Broadcasts distance vector to all neighbors
+*
+*	@param reliable
+*		1 for triggered updates, which are acked and retransmitted
+*
+*/
+void send_update_pkt(int reliable){
+	int i;
+	char legacy_buf[MAX_PKT_SIZE],compact_buf[MAX_PKT_SIZE]; // the vector is the same for every neighbor, encode once per round
+	int legacy_len=0,compact_len=0;
+	char *pkt;
+	int pkt_len;
 
-		for(i=0;i<num_of_servers;i++){
-			if(servers[i].next_hop==to){
-				servers[i].cost=USHRT_MAX;
-				adj_matrix[from-1][i]=USHRT_MAX;
-				adj_matrix[i][from-1]=USHRT_MAX;
-				servers[i].next_hop=-1;
+	update_vector_version();
+	for(i=0;i<num_of_servers;i++) {
+		if(servers[i].is_neighbor==1 && servers[i].is_alive==1){
+			if(!reliable && unchanged_keepalives && servers[i].peer_versions && servers[i].sent_version==vector_version){
+				send_unchanged(i); // the neighbor has this vector already
+				continue;
 			}
+			pkt_len=update_pkt_for(i,legacy_buf,&legacy_len,compact_buf,&compact_len,&pkt);
+			send_update_to(i,pkt,pkt_len,reliable);
 		}
 	}
+}
 
-	send_update_pkt(); //inform about link cost change
-	strcpy(response_message,"SUCCESS");	
-	return 1;
+/*
+*
+*	Keeps neighbors' dead timers on the base interval while the periodic update is backed
+*	off: a keepalive to neighbors that take them and hold my vector, the full vector to the rest
+*
+*/
+void send_keepalives(){
+	int i;
+	char legacy_buf[MAX_PKT_SIZE],compact_buf[MAX_PKT_SIZE];
+	int legacy_len=0,compact_len=0;
+	char *pkt;
+	int pkt_len;
 
-	
+	update_vector_version();
+	for(i=0;i<num_of_servers;i++) {
+		if(servers[i].is_neighbor!=1 || servers[i].is_alive!=1)
+			continue;
+		if(servers[i].peer_versions && servers[i].sent_version==vector_version)
+			send_unchanged(i);
+		else{
+			pkt_len=update_pkt_for(i,legacy_buf,&legacy_len,compact_buf,&compact_len,&pkt);
+			send_update_to(i,pkt,pkt_len,0);
+		}
+	}
 }
 
 /*
 *
-*	Prepares the routing update packet that has to broadcasted to all neighbors
-*
-*	@param packet_to_send
-*		Routing update packet
+*	Hashes what my vector tells neighbors: the advertised costs and the prefixes (FNV-1a)
 *
 */
-
-void prepare_update_pkt(struct routing_update_pkt * packet_to_send){
+uint64_t vector_hash(){
+	uint64_t hash=14695981039346656037ULL;
 	int j;
 
-	packet_to_send->num_of_updates=htons(num_of_servers);
-	packet_to_send->sender_port=htons(my_port);
-	packet_to_send->sender_ip=htonl(my_ip);
-
 	for(j=0;j<num_of_servers;j++){
-		packet_to_send->updates[j].server_ip=htonl(servers[j].server_ip);
-		packet_to_send->updates[j].server_port=htons(servers[j].server_port);
-		packet_to_send->updates[j].padding=0;
-		packet_to_send->updates[j].server_id=htons(servers[j].server_id);
-		packet_to_send->updates[j].cost=htons(adj_matrix[my_id-1][j]);
+		if(is_advertised(j))
+			hash=(hash^adj_matrix[my_index][j])*1099511628211ULL;
+	}
+	for(j=0;j<fib.num_of_prefixes;j++){
+		hash=(hash^fib.prefixes[j].prefix)*1099511628211ULL;
+		hash=(hash^(fib.prefixes[j].len|(uint32_t)fib.prefixes[j].dest<<8))*1099511628211ULL;
 	}
+	return hash;
+}
 
+/*
+*
+*	Bumps vector_version if my vector changed since the last call
+*
+*/
+void update_vector_version(){
+	uint64_t hash=vector_hash();
 
+	if(hash!=last_vector_hash){
+		last_vector_hash=hash;
+		vector_version++;
+	}
 }
 
 /*
 *
-*	Serializes the routing update packet packet_to_send and stores it in serialized_packet
+*	Tells neighbor index that my vector is still vector_version, also refreshing its dead neighbor timer
 *
-*	@param packet_to_send
-*		Routing update packet
+*/
+void send_unchanged(int index){
+	uint8_t unchanged[UNCHANGED_PKT_SIZE];
+	uint16_t id=htons(my_id);
+	uint32_t version=htonl(vector_version);
+	uint32_t interval=htonl(current_interval_ms);
+
+	unchanged[0]=PKT_MAGIC;
+	unchanged[1]=PKT_UNCHANGED;
+	memcpy(unchanged+2,&id,2);
+	memcpy(unchanged+4,&version,4);
+	memcpy(unchanged+8,&interval,4);
+
+	if(send_to_server(index,unchanged,sizeof(unchanged))<0)
+		perror("send unchanged");
+	else{
+		interval_stats.pkts_sent++;
+		interval_stats.bytes_sent+=sizeof(unchanged);
+		interval_stats.keepalives_sent++;
+	}
+}
+
+/*
 *
-*	@param serialized_packet
-*		Serialized packet
+*	Asks neighbor index for its full vector
 *
 */
+void send_resync(int index){
+	uint8_t resync[RESYNC_PKT_SIZE];
+	uint16_t id=htons(my_id);
+
+	resync[0]=PKT_MAGIC;
+	resync[1]=PKT_RESYNC;
+	memcpy(resync+2,&id,2);
+
+	if(send_to_server(index,resync,sizeof(resync))<0)
+		perror("send resync");
+	else{
+		interval_stats.pkts_sent++;
+		interval_stats.bytes_sent+=sizeof(resync);
+		interval_stats.resyncs_sent++;
+	}
+}
+
+/*
+*
+*	Processes a keepalive. If I hold the version it names, the neighbor only counts
+*	as heard from: no decoding, no recompute. Otherwise I missed a vector and ask
+*	for it again; a neighbor declared dead also comes back through its full vector.
+*
+*/
+void process_unchanged(void * packet,int pkt_len){
+	uint16_t sender_id;
+	uint32_t version,interval;
+	int sender;
+
+	if(pkt_len<UNCHANGED_PKT_SIZE)
+		return;
+	memcpy(&sender_id,packet+2,2);
+	memcpy(&version,packet+4,4);
+	memcpy(&interval,packet+8,4);
+	sender_id=ntohs(sender_id);
+	sender=server_index(sender_id);
+	if(sender<0 || sender==my_index)
+		return;
+
+	interval_stats.pkts_received++;
+	interval_stats.bytes_received+=pkt_len;
+	if(servers[sender].is_alive==1 && servers[sender].is_neighbor==1 && ntohl(version)==servers[sender].heard_version){
+		interval_stats.keepalives_received++;
+		servers[sender].update_interval_ms=ntohl(interval);
+		servers[sender].last_heard_ms=now_ms();
+		reset_skip_flag(sender_id);
+	}
+	else if(servers[sender].link_cost!=metric_infinity)
+		send_resync(sender);
+}
+
+/*
+*
+*	Processes a resync request by sending the neighbor my full vector right away
+*
+*/
+void process_resync(void * packet,int pkt_len){
+	uint16_t sender_id;
+	int sender;
+	char legacy_buf[MAX_PKT_SIZE],compact_buf[MAX_PKT_SIZE];
+	int legacy_len=0,compact_len=0;
+	char *pkt;
+	int pkt_len_out;
+
+	if(pkt_len<RESYNC_PKT_SIZE)
+		return;
+	memcpy(&sender_id,packet+2,2);
+	sender=server_index(ntohs(sender_id));
+	if(sender<0 || sender==my_index)
+		return;
+	interval_stats.pkts_received++;
+	interval_stats.bytes_received+=pkt_len;
+	servers[sender].sent_version=0;
+	if(servers[sender].is_neighbor==1 && servers[sender].is_alive==1){
+		pkt_len_out=update_pkt_for(sender,legacy_buf,&legacy_len,compact_buf,&compact_len,&pkt);
+		send_update_to(sender,pkt,pkt_len_out,0);
+	}
+}
+
+/*
+*
+*	Tells every neighbor that I am about to restart: a full vector carrying TLV_RESTART,
+*	after which neighbors keep my vector and their routes through me for window_s seconds
+*
+*/
+void announce_restart(int window_s){
+	int i;
+
+	restart_window_ms=window_s*1000LL;
+	for(i=0;i<num_of_servers;i++)
+		servers[i].sent_version=0; // no keepalives, the TLV has to go out
+	send_update_pkt(0);
+	printf("Announced a restart within %d s\n",window_s);
+}
+
+/*
+*
+*	Ends the restart window of a neighbor when its next full vector arrives
+*
+*/
+void restart_over(int sender){
+	if(servers[sender].restart_until_ms==0)
+		return;
+	printf("Server %d is back from its restart\n",servers[sender].server_id);
+	servers[sender].restart_until_ms=0;
+}
+
+/*
+*
+*	Resends the current vector to neighbors whose newest reliable update went
+*	unacked for its timeout. The timeout doubles with each retransmission; after
+*	RELIABLE_MAX_RETRANSMITS the neighbor is left to the periodic update.
+*
+*/
+void retransmit_updates(){
+	int i,retransmits;
+	long long now=now_ms();
+	char legacy_buf[MAX_PKT_SIZE],compact_buf[MAX_PKT_SIZE];
+	int legacy_len=0,compact_len=0;
+	char *pkt;
+	int pkt_len;
+
+	for(i=0;i<num_of_servers;i++){
+		if(servers[i].num_in_flight==0 || now<servers[i].retransmit_ms)
+			continue;
+		if(!servers[i].is_neighbor || !servers[i].is_alive){
+			drop_in_flight(i);
+			continue;
+		}
+		if(servers[i].retransmits>=RELIABLE_MAX_RETRANSMITS){
+			if(!quiet)
+				printf("Server %d did not ack triggered update %u\n",servers[i].server_id,servers[i].in_flight[servers[i].num_in_flight-1]);
+			drop_in_flight(i);
+			interval_stats.reliable_given_up++;
+			continue;
+		}
+
+		// the current vector supersedes everything in flight
+		retransmits=servers[i].retransmits+1;
+		servers[i].num_in_flight=0;
+		pkt_len=update_pkt_for(i,legacy_buf,&legacy_len,compact_buf,&compact_len,&pkt);
+		if(send_update_to(i,pkt,pkt_len,1)>0 && servers[i].num_in_flight>0){
+			servers[i].retransmits=retransmits;
+			servers[i].retransmit_ms=now+(reliable_rto_ms<<retransmits);
+		}
+		interval_stats.retransmits++;
+	}
+	update_retransmit_timer();
+}
+
+/*
+*
+*	Forgets the reliable updates in flight to neighbor index
+*
+*/
+void drop_in_flight(int index){
+	servers[index].num_in_flight=0;
+	servers[index].send_deferred=0;
+	update_retransmit_timer();
+}
+
+/*
+*
+*	Sets next_retransmit_ms to the earliest retransmit timer, 0 if nothing is in flight
+*
+*/
+void update_retransmit_timer(){
+	int i;
+
+	next_retransmit_ms=0;
+	for(i=0;i<num_of_servers;i++){
+		if(servers[i].num_in_flight>0 && (next_retransmit_ms==0 || servers[i].retransmit_ms<next_retransmit_ms))
+			next_retransmit_ms=servers[i].retransmit_ms;
+	}
+}
+
+/*
+*
+*	Acks the reliable updates accepted from neighbor index: the newest, which supersedes
+*	everything before it, and a bitmap of which of the ACK_BITMAP_BITS before it arrived
+*
+*/
+void send_ack(int index){
+	uint8_t ack[ACK_PKT_SIZE];
+	uint16_t id=htons(my_id);
+	uint32_t seq=htonl(servers[index].ack_seq);
+	uint32_t bitmap=htonl(servers[index].ack_bitmap);
+
+	ack[0]=PKT_MAGIC;
+	ack[1]=PKT_ACK;
+	memcpy(ack+2,&id,2);
+	memcpy(ack+4,&seq,4);
+	memcpy(ack+8,&bitmap,4);
+
+	if(send_to_server(index,ack,sizeof(ack))<0)
+		perror("send ack");
+	else{
+		interval_stats.pkts_sent++;
+		interval_stats.bytes_sent+=sizeof(ack);
+	}
+}
+
+/*
+*
+*	Records the sequence number of a reliable update from neighbor index for its next ack
+*
+*/
+void note_seq(int index,uint32_t seq){
+	int32_t ahead=(int32_t)(seq-servers[index].ack_seq);
+
+	if(servers[index].ack_seq==0 || ahead>ACK_BITMAP_BITS || ahead<-ACK_BITMAP_BITS){ // first, or the neighbor restarted its numbering
+		servers[index].ack_seq=seq;
+		servers[index].ack_bitmap=0;
+	}
+	else if(ahead>0){
+		servers[index].ack_bitmap=(ahead==ACK_BITMAP_BITS ? 0 : servers[index].ack_bitmap<<ahead)|1u<<(ahead-1);
+		servers[index].ack_seq=seq;
+	}
+	else if(ahead<0)
+		servers[index].ack_bitmap|=1u<<(-ahead-1);
+	servers[index].ack_pending=1;
+}
+
+/*
+*
+*	Processes an ack from a live neighbor. Every update in flight up to the acked one
+*	leaves the window: the ack or the bitmap names it, or the newer vector acked
+*	supersedes it. A deferred update goes out as soon as the window opens.
+*
+*/
+void process_ack(void * packet,int pkt_len){
+	uint16_t sender_id;
+	uint32_t seq,bitmap;
+	int32_t behind;
+	int i,j=0,index;
+
+	if(pkt_len<ACK_PKT_SIZE)
+		return;
+	memcpy(&sender_id,packet+2,2);
+	memcpy(&seq,packet+4,4);
+	memcpy(&bitmap,packet+8,4);
+	sender_id=ntohs(sender_id);
+	seq=ntohl(seq);
+	bitmap=ntohl(bitmap);
+	index=server_index(sender_id);
+	if(index<0 || index==my_index || servers[index].is_neighbor!=1 || servers[index].is_alive!=1) // like updates, acks count only from live neighbors
+		return;
+	interval_stats.pkts_received++;
+	interval_stats.bytes_received+=pkt_len;
+
+	for(i=0;i<servers[index].num_in_flight;i++){
+		behind=(int32_t)(seq-servers[index].in_flight[i]);
+		if(behind<0) // sent after the acked one, still in flight
+			servers[index].in_flight[j++]=servers[index].in_flight[i];
+		else if(behind==0 || (behind<=ACK_BITMAP_BITS && (bitmap>>(behind-1)&1)))
+			interval_stats.acks_received++;
+	}
+	servers[index].num_in_flight=j;
+
+	if(servers[index].num_in_flight==0)
+		servers[index].retransmits=0;
+	update_retransmit_timer();
+	if(servers[index].send_deferred && servers[index].num_in_flight<RELIABLE_WINDOW && servers[index].is_neighbor && servers[index].is_alive){
+		char legacy_buf[MAX_PKT_SIZE],compact_buf[MAX_PKT_SIZE];
+		int legacy_len=0,compact_len=0;
+		char *pkt;
+		int pkt_len=update_pkt_for(index,legacy_buf,&legacy_len,compact_buf,&compact_len,&pkt);
+		send_update_to(index,pkt,pkt_len,1);
+	}
+}
+
+/*
+*
+*	Returns a monotonic timestamp in milliseconds
+*
+*/
+long long now_ms(){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC,&ts);
+	return (long long)ts.tv_sec*1000+ts.tv_nsec/1000000;
+}
+
+/*
+*
+*	Returns interval shortened by a random 0..jitter_percent so routers drift out of lockstep
+*
+*/
+long long jittered(long long interval){
+	if(jitter_percent<=0)
+		return interval;
+	return interval-(interval*(rand()%(jitter_percent+1)))/100;
+}
+
+/*
+*
+*	Sends the periodic update. The interval doubles (up to max_backoff times the
+*	base interval) after every period without route changes and is reset on change.
+*	The new interval is decided before sending so it can be advertised in TLV_INTERVAL.
+*
+*/
+void send_periodic_update(){
+	long long now=now_ms();
+	int64_t start_ns=event_tracing ? event_clock_ns() : 0;
+	unsigned long pkts_sent=interval_stats.pkts_sent;
+
+	if(routes_changed)
+		current_interval_ms=base_interval_ms;
+	else if(current_interval_ms*2<=base_interval_ms*max_backoff)
+		current_interval_ms*=2;
+	routes_changed=0;
+
+	send_update_pkt(0);
+	interval_stats.periodic_rounds++;
+	if(event_tracing)
+		event_record(EVENT_PERIODIC_SEND,start_ns,interval_stats.pkts_sent-pkts_sent,0,0,0);
+	next_periodic_ms=now+jittered(current_interval_ms);
+}
+
+/*
+*
+*	Schedules a triggered update. Triggers within hold_down_ms of the first one are coalesced into one send.
+*
+*/
+void schedule_triggered_update(){
+	if(triggered_pending)
+		return;
+	triggered_pending=1;
+	triggered_due_ms=now_ms()+hold_down_ms;
+	triggered_cause=event_cause; // later triggers are coalesced into this one
+}
+
+/*
+*
+*	Sends the pending triggered update
+*
+*/
+void send_triggered_update(){
+	int64_t start_ns=event_tracing ? event_clock_ns() : 0;
+	unsigned long pkts_sent=interval_stats.pkts_sent;
+
+	triggered_pending=0;
+	send_update_pkt(1);
+	interval_stats.triggered_rounds++;
+	if(event_tracing)
+		event_record(EVENT_TRIGGERED_SEND,start_ns,interval_stats.pkts_sent-pkts_sent,0,triggered_cause,0);
+}
+
+/*
+*
+*	Called whenever a route changes. Resets the periodic backoff and schedules a triggered update.
+*
+*/
+void note_route_change(){
+	long long now=now_ms();
+
+	routes_changed=1;
+	if(current_interval_ms>base_interval_ms){
+		current_interval_ms=base_interval_ms;
+		if(next_periodic_ms>now+base_interval_ms)
+			next_periodic_ms=now+jittered(base_interval_ms);
+	}
+	schedule_triggered_update();
+}
+
+/*
+*
+*	Returns when the main loop has to wake up next
+*
+*/
+long long next_timer_ms(){
+	long long next=next_periodic_ms;
+	if(next_tick_ms<next)
+		next=next_tick_ms;
+	if(hello_interval_ms>0 && next_hello_ms<next)
+		next=next_hello_ms;
+	if(triggered_pending && triggered_due_ms<next)
+		next=triggered_due_ms;
+	if(next_retransmit_ms>0 && next_retransmit_ms<next)
+		next=next_retransmit_ms;
+	if(next_ack_ms>0 && next_ack_ms<next)
+		next=next_ack_ms;
+	return next;
+}
+
+/*
+*
+*	Sends a hello to every live neighbor
+*
+*/
+void send_hellos(){
+	uint8_t hello[HELLO_PKT_SIZE];
+	uint16_t id=htons(my_id);
+	uint16_t interval=htons(hello_interval_ms);
+	int i;
+
+	hello[0]=PKT_MAGIC;
+	hello[1]=PKT_HELLO;
+	memcpy(hello+2,&id,2);
+	memcpy(hello+4,&interval,2);
+
+	for(i=0;i<num_of_servers;i++){
+		if(servers[i].link_cost==metric_infinity || i==my_index) // no link, or disabled
+			continue;
+		if(send_to_server(i,hello,HELLO_PKT_SIZE)<0)
+			perror("send hello");
+		else{
+			interval_stats.pkts_sent++;
+			interval_stats.bytes_sent+=HELLO_PKT_SIZE;
+		}
+	}
+}
+
+/*
+*
+*	Marks neighbors that sent hellos before but missed HELLO_DEAD_MULTIPLIER of them
+*	so check_dead_neighbors() picks them up
+*
+*/
+void check_hellos(){
+	int i;
+	long long now=now_ms();
+
+	for(i=0;i<num_of_servers;i++){
+		if(!servers[i].is_neighbor || servers[i].last_hello_ms==0)
+			continue;
+		if(now-servers[i].last_hello_ms>HELLO_DEAD_MULTIPLIER*(long long)servers[i].hello_interval_ms){
+			printf("No hello from server %d for %lld ms\n",servers[i].server_id,now-servers[i].last_hello_ms);
+			servers[i].num_of_skips=3;
+			servers[i].last_hello_ms=0;
+		}
+	}
+}
+
+/*
+*
+*	Processes a hello. Only refreshes liveness; a dead neighbor comes back with its next update.
+*
+*/
+void process_hello(void * packet,int pkt_len){
+	uint16_t sender_id,interval;
+	int sender;
+
+	if(pkt_len<HELLO_PKT_SIZE)
+		return;
+	memcpy(&sender_id,packet+2,2);
+	memcpy(&interval,packet+4,2);
+	sender_id=ntohs(sender_id);
+	sender=server_index(sender_id);
+	if(sender<0)
+		return;
+
+	interval_stats.pkts_received++;
+	interval_stats.bytes_received+=pkt_len;
+	if(servers[sender].is_alive==0 || servers[sender].is_neighbor==0)
+		return;
+	servers[sender].hello_interval_ms=ntohs(interval);
+	servers[sender].last_hello_ms=now_ms();
+	servers[sender].last_heard_ms=servers[sender].last_hello_ms;
+	reset_skip_flag(sender_id);
+}
+
+/*
+*
+*	Prints and resets the per interval traffic counters
+*
+*/
+void report_interval_stats(){
+	printf("Interval stats: sent %lu pkts %lu bytes (%lu periodic, %lu triggered rounds), received %lu pkts %lu bytes, next periodic in %lld ms\n",
+		interval_stats.pkts_sent,interval_stats.bytes_sent,interval_stats.periodic_rounds,interval_stats.triggered_rounds,
+		interval_stats.pkts_received,interval_stats.bytes_received,next_periodic_ms-now_ms());
+	uint32_t dropped=rx_dropped+rx_shard_dropped();
+
+	printf("Receive path: processed %lu pkts (%.0f pkts/s), kernel drops %lu (total %u)\n",
+		interval_stats.pkts_processed,interval_stats.pkts_processed*1000.0/base_interval_ms,
+		(unsigned long)(dropped-rx_dropped_reported),dropped);
+	rx_dropped_reported=dropped;
+	if(rx_shards>1)
+		rx_shard_report();
+	if(reliable_rto_ms>0)
+		printf("Reliable updates: %lu acked, %lu retransmitted, %lu given up\n",
+			interval_stats.acks_received,interval_stats.retransmits,interval_stats.reliable_given_up);
+	if(unchanged_keepalives)
+		printf("Unchanged vectors: %lu keepalives sent, %lu received, %lu resyncs asked (version %u)\n",
+			interval_stats.keepalives_sent,interval_stats.keepalives_received,interval_stats.resyncs_sent,vector_version);
+
+	total_stats.pkts_sent+=interval_stats.pkts_sent;
+	total_stats.bytes_sent+=interval_stats.bytes_sent;
+	total_stats.pkts_received+=interval_stats.pkts_received;
+	total_stats.bytes_received+=interval_stats.bytes_received;
+	total_stats.periodic_rounds+=interval_stats.periodic_rounds;
+	total_stats.pkts_processed+=interval_stats.pkts_processed;
+	total_stats.triggered_rounds+=interval_stats.triggered_rounds;
+	total_stats.acks_received+=interval_stats.acks_received;
+	total_stats.retransmits+=interval_stats.retransmits;
+	total_stats.reliable_given_up+=interval_stats.reliable_given_up;
+	total_stats.keepalives_sent+=interval_stats.keepalives_sent;
+	total_stats.keepalives_received+=interval_stats.keepalives_received;
+	total_stats.resyncs_sent+=interval_stats.resyncs_sent;
+	memset(&interval_stats,0,sizeof(interval_stats));
+}
+
+/*
+*
+*	Updates num_of_skips of every neighbor to the number of base intervals that passed
+*	without hearing from it. Backed off neighbors still send keepalives every base
+*	interval, so a failure is detected in 3 base intervals whatever the backoff.
+*
+*/
+void count_skips(){
+	int i;
+	long long now=now_ms();
+
+	for (i = 0; i < num_of_servers; i++){
+		if(servers[i].is_neighbor!=1)
+			continue;
+		servers[i].num_of_skips=(now-servers[i].last_heard_ms)/base_interval_ms;
+	}
+}
+
+/*
+*
+*	Declares neighbors that missed 3 base intervals dead and withdraws their routes
+*
+*/
+void check_dead_neighbors(){
+	int i;
+	long long now=now_ms();
+
+	for (i = 0; i < num_of_servers; i++){
+		if(!servers[i].is_neighbor)
+			continue;
+		if (servers[i].num_of_skips >= 3 && servers[i].restart_until_ms<=now) { // a restarting neighbor's routes stay usable until its window closes
+			if(servers[i].restart_until_ms>0){
+				printf("Server %d did not come back from its restart, dropping its routes\n",servers[i].server_id);
+				servers[i].restart_until_ms=0;
+			}
+
+			if(event_tracing){
+				event_cause=event_next_id();
+				event_record(EVENT_NEIGHBOR_DOWN,event_clock_ns(),servers[i].server_id,0,0,event_cause);
+			}
+			servers[i].is_alive = 0;
+			servers[i].is_neighbor=0;
+			servers[i].last_hello_ms=0;
+			drop_in_flight(i);
+			neighbor_down(i);
+			if(damp_event(&servers[i].link_damp,DAMP_DOWN_PENALTY))
+				printf("Link to server %d damped\n",servers[i].server_id);
+			note_route_change();
+			event_cause=0;
+		}
+	}
+}
+
+/*
+*
+*	Returns the flap penalty decayed to the current time, without changing it
+*
+*/
+double damp_penalty(struct damping *damp){
+	if(damp_half_life_ms<=0 || damp->penalty<=0)
+		return 0;
+	return damp->penalty*exp2(-(now_ms()-damp->updated_ms)/damp_half_life_ms);
+}
+
+/*
+*
+*	Decays a flap penalty exponentially to the current time and releases suppression
+*	once it falls below DAMP_REUSE
+*
+*	@return
+*		1 if the link or route is suppressed
+*
+*/
+int damp_decay(struct damping *damp){
+	long long now=now_ms();
+
+	if(damp_half_life_ms<=0)
+		return 0;
+	damp->penalty=damp_penalty(damp);
+	damp->updated_ms=now;
+	if(damp->suppressed && damp->penalty<DAMP_REUSE)
+		damp->suppressed=0;
+	return damp->suppressed;
+}
+
+/*
+*
+*	Charges a flap penalty
+*
+*	@param penalty
+*		DAMP_DOWN_PENALTY or DAMP_CHANGE_PENALTY
+*
+*	@return
+*		1 if the link or route is suppressed
+*
+*/
+int damp_event(struct damping *damp,int penalty){
+	if(damp_half_life_ms<=0)
+		return 0;
+	damp_decay(damp);
+	damp->penalty+=penalty;
+	if(damp->penalty>DAMP_CEILING)
+		damp->penalty=DAMP_CEILING;
+	if(!damp->suppressed && damp->penalty>=DAMP_SUPPRESS){
+		damp->suppressed=1;
+		suppress_events++;
+	}
+	return damp->suppressed;
+}
+
+/*
+*
+*	Withdraws the direct link to a neighbor and every route that can only go through it
+*
+*	@param index
+*		Index of the neighbor in servers
+*
+*/
+void neighbor_down(int index){
+	servers[index].cost=metric_infinity; // most likely the server itself failed, no alternate for it
+	set_next_hop(index,-1);
+	servers[index].backup=-1;
+	servers[index].heard_version=0; // its vector is stale once it comes back
+	servers[index].ack_seq=0; // and it may number its updates from 1 again
+	adj_matrix[my_index][index]= metric_infinity;
+	adj_matrix[index][my_index]= metric_infinity; 
+	withdraw_routes_via(index);
+	refresh_fib();
+}
+
+/*
+*
+*	Moves every route through a neighbor that went away to another equal cost next hop
+*	or, when it was the only one, to the route's loop-free alternate if that is still
+*	usable. Routes left without either become unreachable until the next bellman_ford().
+*
+*	@param index
+*		Index of the neighbor in servers, its own link must already be withdrawn
+*
+*/
+void withdraw_routes_via(int index){
+	int j,backup;
+
+	for(j=0;j<num_of_servers;j++){
+		if(j==my_index)
+			continue;
+		if(!remove_next_hop(j,servers[index].server_id)){ // another equal cost next hop is left
+			if(servers[j].backup==index)
+				servers[j].backup=-1;
+			continue;
+		}
+		if(servers[j].cost==metric_infinity)
+			continue;
+		backup=servers[j].backup;
+		servers[j].backup=-1;
+		if(backup>=0 && backup!=index && servers[backup].is_neighbor && servers[backup].is_alive && !servers[backup].link_damp.suppressed
+			&& servers[backup].link_cost<metric_infinity && adj_matrix[backup][j]<metric_infinity){
+			servers[j].cost=metric_add(adj_matrix[backup][j],servers[backup].link_cost);
+			set_next_hop(j,backup==j ? my_id : servers[backup].server_id);
+			lfa_failovers++;
+		}
+		else
+			servers[j].cost=metric_infinity;
+		adj_matrix[my_index][j]=servers[j].cost; // advertised until the next bellman_ford()
+	}
+}
+
+/*
+*
+*	Picks the loop-free alternate for a destination: the cheapest usable neighbor outside
+*	its next hop set whose own distance to it is shorter than going back through me,
+*	D(N,D) < D(N,S) + D(S,D), so traffic handed to it can not loop back
+*
+*	@param usable
+*		Indexes of the neighbors a route can go through
+*
+*	@return
+*		Index of the alternate neighbor, -1 if there is none
+*
+*/
+int find_backup(int dest,int *usable,int num_of_usable){
+	int i,k,n,backup=-1;
+	metric_t cost,backup_cost=metric_infinity;
+
+	if(servers[dest].cost==metric_infinity)
+		return -1;
+	for(i=0;i<num_of_usable;i++){
+		n=usable[i];
+		if(adj_matrix[n][dest]>=metric_infinity || adj_matrix[n][my_index]>=metric_infinity)
+			continue;
+		for(k=0;k<servers[dest].num_of_next_hops;k++){
+			if(servers[dest].next_hops[k]==servers[n].server_id)
+				break;
+		}
+		if(k<servers[dest].num_of_next_hops) // already a primary next hop
+			continue;
+		if(adj_matrix[n][dest]>=metric_add(adj_matrix[n][my_index],servers[dest].cost)) // n may route back through me
+			continue;
+		cost=metric_add(adj_matrix[n][dest],servers[n].link_cost);
+		if(cost<backup_cost){
+			backup_cost=cost;
+			backup=n;
+		}
+	}
+	return backup;
+}
+
+/*
+*
+*	Restores the direct link to a neighbor that came back or stopped flapping
+*
+*	@param index
+*		Index of the neighbor in servers
+*
+*/
+void neighbor_up(int index){
+	servers[index].is_alive=1;
+	servers[index].is_neighbor=1;
+	servers[index].num_of_skips=0;
+	servers[index].last_heard_ms=now_ms();
+	servers[index].sent_version=0; // it may have missed any number of versions
+	adj_matrix[my_index][index]=servers[index].link_cost;
+	adj_matrix[index][my_index]=servers[index].link_cost;
+	if(servers[index].link_cost<servers[index].cost){
+		servers[index].cost=servers[index].link_cost;
+		set_next_hop(index,my_id);
+	}
+	refresh_fib();
+}
+
+/*
+*
+*	Reinstates links whose flap penalty decayed below DAMP_REUSE. Called every base interval.
+*
+*/
+void release_damped_links(){
+	int i,released=0;
+
+	for(i=0;i<num_of_servers;i++){
+		if(!servers[i].link_damp.suppressed)
+			continue;
+		if(damp_decay(&servers[i].link_damp))
+			continue;
+		printf("Link to server %d no longer damped\n",servers[i].server_id);
+		if(servers[i].is_alive && servers[i].is_neighbor && servers[i].link_cost!=metric_infinity)
+			neighbor_up(i);
+		released=1;
+	}
+	for(i=0;i<num_of_servers;i++){
+		if(servers[i].route_damp.suppressed && !damp_decay(&servers[i].route_damp))
+			released=1;
+	}
+	if(released){
+		bellman_ford();
+		note_route_change(); // advertise what the damped state held back
+	}
+}
+
+
+/*
+*
+*	Disables the link to a neighbor
+*
+*	@param server_id
+*		Neighbor ID whose link has to be disabled
+*
+*	@return 
+*		Integer indicating success/failure of function
+*
+*/
+int disable(int server_id){
+	int index=server_index(server_id);
+	memset(response_message,0,sizeof(response_message));
+	if(index<0){
+		sprintf(response_message, "Server %d is invalid", server_id);
+		return -1;
+
+	}
+	if(servers[index].is_neighbor==0){
+		sprintf(response_message, "Server %d is not a neighbor", server_id);
+		return -1;
+	}
+
+	
+	servers[index].is_neighbor=0;
+	servers[index].link_cost=metric_infinity; // disabled links never come back
+	drop_in_flight(index);
+	adj_matrix[my_index][index]=metric_infinity;
+	adj_matrix[index][my_index]=metric_infinity;
+	withdraw_routes_via(index); // the server may still be reachable through its alternate
+	refresh_fib();
+	note_route_change();
+		
+
+	strcpy(response_message,"SUCCESS");
+	
+	return 1;
+	
+}
+
+
+/*
+*
+*	Updates the link cost to a neighbor
+*
+*	@param from
+*		Source ID
+*
+*	@param to
+*		Destination ID
+*
+*	@param cost
+*		New cost
+*
+*	@return 
+*		Integer indicating success/failure of function
+*
+*/
+int update_link_cost(int from,int to,char* cost){
+	int from_index=server_index(from),to_index=server_index(to);
+	memset(response_message,0,sizeof(response_message));
+	metric_t new_cost;
+	int inf_flag=0;
+	if(strcmp(cost,"inf")==0 || strcmp(cost,"INF")==0 || strtoul(cost,NULL,10)>=metric_infinity){
+		inf_flag=1;
+		new_cost=metric_infinity;
+
+	}
+	else {
+		new_cost=strtoul(cost,NULL,10);
+
+	}
+	if(from_index<0){
+		sprintf(response_message, "Server %d is invalid", from);
+		return -1;
+	}
+	if(to_index<0){
+		sprintf(response_message, "Server %d is invalid", to);
+		return -1;
+	}	
+	if(from!=my_id && to!=my_id){
+		strcpy(response_message,"You can only change link cost of neighbors");
+
+		return -1;
+	}
+	if(from==to){
+		strcpy(response_message,"Self links are always 0. You cannot modify self links");
+		return -1;
+	}	
+	if(servers[to_index].is_neighbor==0){
+		sprintf(response_message, "Server %d is not a neighbor", to);
+
+		return -1;
+
+	}	
+
+	printf("%d %d %lu\n",from,to,(unsigned long)new_cost);
+
+	if(new_cost!=servers[to_index].link_cost && damp_event(&servers[to_index].link_damp,inf_flag ? DAMP_DOWN_PENALTY : DAMP_CHANGE_PENALTY)){
+		servers[to_index].link_cost=new_cost;
+		if(!inf_flag){ // keep a flapping link withdrawn until its penalty decays
+			neighbor_down(to_index);
+			sends_avoided++;
+			strcpy(response_message,"SUCCESS (link damped)");
+			return 1;
+		}
+	}
+	servers[to_index].link_cost=new_cost;
+	
+	adj_matrix[from_index][to_index]=new_cost;
+	adj_matrix[to_index][from_index]=new_cost;
+	servers[to_index].cost=new_cost;
+	set_next_hop(to_index,from);
+
+
+	if(inf_flag==1){
+		set_next_hop(to_index,-1);
+		servers[to_index].backup=-1;
+		withdraw_routes_via(to_index);
+	}
+
+	refresh_fib();
+	note_route_change(); //inform about link cost change, at the base interval again
+	strcpy(response_message,"SUCCESS");	
+	return 1;
+
+	
+}
+
+/*
+*
+*	Builds the graph this server knows of: its own usable links and, for every live
+*	neighbor, one edge per entry of the neighbor's distance vector. Entries the
+*	neighbor most likely reaches through this server are left out, they would hide
+*	a failure on this side (ties count as through this server). My links themselves
+*	are added by whatif_solve(), from link.
+*
+*	@param link
+*		Filled with the cost of each of my links, APSP_INF if there is none
+*
+*/
+void whatif_graph(struct apsp *graph,uint32_t *link){
+	int i,d,me=my_index;
+
+	for(i=0;i<num_of_servers;i++){
+		link[i]=APSP_INF;
+		if(i==me || !servers[i].is_neighbor || !servers[i].is_alive || servers[i].link_damp.suppressed || servers[i].link_cost==metric_infinity)
+			continue;
+		link[i]=servers[i].link_cost;
+		for(d=0;d<num_of_servers;d++){
+			if(d==i || d==me || adj_matrix[i][d]==metric_infinity)
+				continue;
+			if(servers[d].cost!=metric_infinity && servers[d].next_hop!=servers[i].server_id && adj_matrix[i][me]!=metric_infinity
+					&& adj_matrix[i][d]==metric_add(adj_matrix[i][me],servers[d].cost))
+				continue;
+			apsp_set(graph,i,d,adj_matrix[i][d]);
+		}
+	}
+}
+
+/*
+*
+*	Solves the rows of this server and its neighbors and picks my next hop to every destination
+*
+*	@param link
+*		Cost of each of my links, APSP_INF if there is none
+*
+*	@param hops
+*		Filled with the next hop server ID to every destination, -1 if unreachable
+*
+*	@return
+*		Number of threads used, -1 on error
+*
+*/
+int whatif_solve(struct apsp *graph,uint32_t *link,int *hops){
+	int i,d,j,me=my_index,threads=0,num_of_sources=0,current;
+	int *sources=(int*)malloc(sizeof(int)*num_of_servers);
+	uint32_t best,through;
+
+	for(i=0;i<num_of_servers;i++){
+		if(link[i]!=APSP_INF){
+			apsp_set(graph,me,i,link[i]);
+			apsp_set(graph,i,me,link[i]);
+			sources[num_of_sources++]=i;
+		}
+	}
+	sources[num_of_sources++]=me;
+
+	if(!apsp_is_sparse(graph))
+		threads=apsp_solve(graph,0);
+	else if(apsp_solve_rows(graph,sources,num_of_sources)>0)
+		threads=1;
+	free(sources);
+	if(threads<=0)
+		return -1;
+
+	for(d=0;d<num_of_servers;d++){
+		hops[d]=-1;
+		best=apsp_get(graph,me,d);
+		if(d==me || best>=APSP_INF)
+			continue;
+		current=servers[d].next_hop==my_id ? servers[d].server_id : servers[d].next_hop;
+		for(j=0;j<num_of_servers;j++){
+			if(link[j]==APSP_INF)
+				continue;
+			through=link[j]+apsp_get(graph,j,d);
+			if(through==best && (hops[d]==-1 || servers[j].server_id==current))
+				hops[d]=servers[j].server_id; // keep the current next hop on ties, like bellman_ford()
+		}
+	}
+	return threads;
+}
+
+void print_cost(uint32_t cost){
+	if(cost>=metric_infinity)
+		printf("inf");
+	else
+		printf("%u",cost);
+}
+
+/*
+*
+*	Reports the routes that would change if the link between id1 and id2 had a new cost,
+*	without touching live state. Both the current and the changed topology are solved
+*	on copies, so only the effect of the change is reported. Only my links to live
+*	neighbors can be changed: other links are known only as distances in vectors.
+*
+*	@param id1
+*		Server ID at one end of the link
+*
+*	@param id2
+*		Server ID at the other end of the link
+*
+*	@param cost
+*		New link cost, "inf" to fail the link
+*
+*	@return
+*		Integer indicating success/failure of function
+*
+*/
+int whatif(int id1,int id2,char* cost){
+	struct apsp before,after;
+	uint32_t *link_before,*link_after,new_cost;
+	int *hops_before,*hops_after;
+	int i,d,me=my_index,threads,changed=0,neighbor_changes=0,neighbor;
+	int index1=server_index(id1),index2=server_index(id2);
+	long long start_ns,end_ns;
+	struct timespec ts;
+
+	memset(response_message,0,sizeof(response_message));
+	if(index1<0 || index2<0){
+		sprintf(response_message, "Server %d is invalid", index1<0 ? id1 : id2);
+		return -1;
+	}
+	if(id1==id2){
+		strcpy(response_message,"Self links are always 0");
+		return -1;
+	}
+	if(index1!=me && index2!=me){
+		sprintf(response_message, "Link %d-%d is not a link of this server, whatif only models my own links", id1, id2);
+		return -1;
+	}
+	neighbor=index1==me ? index2 : index1;
+	if(!servers[neighbor].is_neighbor || !servers[neighbor].is_alive || servers[neighbor].link_damp.suppressed){
+		sprintf(response_message, "Server %d is not a live neighbor, its vector says nothing", servers[neighbor].server_id);
+		return -1;
+	}
+	if(strcmp(cost,"inf")==0 || strcmp(cost,"INF")==0)
+		new_cost=APSP_INF;
+	else if(strtoul(cost,NULL,10)<metric_infinity)
+		new_cost=strtoul(cost,NULL,10);
+	else{
+		sprintf(response_message, "Invalid cost %s", cost);
+		return -1;
+	}
+
+	if(apsp_init(&before,num_of_servers)<0 || apsp_init(&after,num_of_servers)<0){
+		strcpy(response_message,"Out of memory");
+		apsp_free(&before);
+		return -1;
+	}
+	link_before=(uint32_t*)malloc(sizeof(uint32_t)*num_of_servers);
+	link_after=(uint32_t*)malloc(sizeof(uint32_t)*num_of_servers);
+	hops_before=(int*)malloc(sizeof(int)*num_of_servers);
+	hops_after=(int*)malloc(sizeof(int)*num_of_servers);
+
+	clock_gettime(CLOCK_MONOTONIC,&ts);
+	start_ns=ts.tv_sec*1000000000LL+ts.tv_nsec;
+
+	whatif_graph(&before,link_before);
+	whatif_graph(&after,link_after);
+	link_after[neighbor]=new_cost;
+
+	threads=whatif_solve(&before,link_before,hops_before);
+	if(threads>0)
+		threads=whatif_solve(&after,link_after,hops_after);
+
+	clock_gettime(CLOCK_MONOTONIC,&ts);
+	end_ns=ts.tv_sec*1000000000LL+ts.tv_nsec;
+
+	if(threads<0)
+		strcpy(response_message,"Out of memory");
+	else{
+		printf("Link %d-%d at cost ",id1,id2);
+		print_cost(new_cost);
+		printf(": solved %d servers %s in %.2f ms\n",num_of_servers,
+			apsp_is_sparse(&before) ? "(own and neighbor rows)" : "(all pairs)",(end_ns-start_ns)/1e6);
+		for(d=0;d<num_of_servers;d++){
+			if(d==me || (apsp_get(&before,me,d)==apsp_get(&after,me,d) && hops_before[d]==hops_after[d]))
+				continue;
+			if(changed++==0)
+				printf("Server ID\t Cost\t\t Next Hop\n");
+			print_server_id(d);
+			printf("\t\t ");
+			print_cost(apsp_get(&before,me,d));
+			printf(" -> ");
+			print_cost(apsp_get(&after,me,d));
+			printf("\t %d -> %d\n",hops_before[d],hops_after[d]);
+		}
+		for(i=0;i<num_of_servers;i++){
+			if(link_before[i]==APSP_INF || link_after[i]==APSP_INF) // only rows solved in both
+				continue;
+			for(d=0;d<num_of_servers;d++){
+				if(apsp_get(&before,i,d)!=apsp_get(&after,i,d))
+					neighbor_changes++;
+			}
+		}
+		printf("%d of my routes and %d neighbor routes would change\n",changed,neighbor_changes);
+		strcpy(response_message,"SUCCESS");
+	}
+
+	apsp_free(&before);
+	apsp_free(&after);
+	free(link_before);
+	free(link_after);
+	free(hops_before);
+	free(hops_after);
+	return threads<0 ? -1 : 1;
+}
+
+/*
+*
+*	Prepares the routing update packet that has to broadcasted to all neighbors.
+*	In area mode remote areas go out as ENTRY_AREA entries and my links into
+*	other areas are left out, they are covered by the area summaries.
+*
+*	@param packet_to_send
+*		Routing update packet
+*
+*/
+
+void prepare_update_pkt(struct routing_update_pkt * packet_to_send){
+	int j,k=0;
+
+	packet_to_send->sender_port=htons(my_port);
+	packet_to_send->sender_ip=htonl(my_ip);
+
+	for(j=0;j<num_of_servers;j++){
+		if(!is_advertised(j))
+			continue;
+		packet_to_send->updates[k].server_ip=htonl(servers[j].server_ip);
+		packet_to_send->updates[k].server_port=htons(servers[j].server_port);
+		packet_to_send->updates[k].padding=htons(servers[j].is_area ? ENTRY_AREA : 0);
+		packet_to_send->updates[k].server_id=htons(servers[j].is_area ? servers[j].area : servers[j].server_id);
+		packet_to_send->updates[k].cost=htons(metric_to_wire(adj_matrix[my_index][j]));
+		k++;
+	}
+	packet_to_send->num_of_updates=htons(k);
+
+
+}
+
+/*
+*
+*	Serializes the routing update packet packet_to_send and stores it in serialized_packet
+*
+*	@param packet_to_send
+*		Routing update packet
+*
+*	@param serialized_packet
+*		Serialized packet, at least MAX_PKT_SIZE bytes
+*
+*	@return
+*		Number of bytes written
+*
+*/
+
+int serialize_packet(struct routing_update_pkt * packet_to_send,void *serialized_packet) {
 
-void serialize_packet(struct routing_update_pkt * packet_to_send,void *serialized_packet) {
-
 	int j;
+	int num_of_updates=ntohs(packet_to_send->num_of_updates);
+	int header_len=8+12*num_of_updates;
 	
-	memset(serialized_packet,0,1000);
+	memset(serialized_packet,0,header_len);
 
 	void*cur=serialized_packet;
 
@@ -526,24 +1890,266 @@ void serialize_packet(struct routing_update_pkt * packet_to_send,void *serialize
 	memcpy(cur,&packet_to_send->sender_ip,sizeof(uint32_t));
 	cur+=4;		
 
-	for(j =0;j<num_of_servers;j++) {
+	for(j =0;j<num_of_updates;j++) {
 
 		memcpy(cur,&packet_to_send->updates[j].server_ip,sizeof(uint32_t));
 		cur+=4;
 
-		memcpy(cur,&packet_to_send->updates[j].server_port,sizeof(uint16_t));
-		cur+=2;
-		//0x0
-		cur+=2;
+		memcpy(cur,&packet_to_send->updates[j].server_port,sizeof(uint16_t));
+		cur+=2;
+		//0x0, or ENTRY_AREA
+		memcpy(cur,&packet_to_send->updates[j].padding,sizeof(uint16_t));
+		cur+=2;
+
+		memcpy(cur,&packet_to_send->updates[j].server_id,sizeof(uint16_t));
+		cur+=2;
+
+		memcpy(cur,&packet_to_send->updates[j].cost,sizeof(uint16_t));
+		cur+=2;
+
+	}
+
+	cur+=serialize_interval_tlv(cur);
+	if(unchanged_keepalives)
+		cur+=serialize_version_tlv(cur);
+	if(restart_window_ms>0)
+		cur+=serialize_restart_tlv(cur);
+	if(compact_updates)
+		cur+=serialize_flag_tlv(cur,TLV_COMPACT);
+	if(reliable_rto_ms>0)
+		cur+=serialize_flag_tlv(cur,TLV_ACKS);
+	cur+=serialize_prefix_tlv(cur,MAX_PKT_SIZE-(cur-serialized_packet)-TLV_SEQ_SIZE);
+
+	memset(cur,0,4); // TLV_END
+	cur+=4;
+
+	return cur-serialized_packet;
+	
+}
+
+/*
+*
+*	Appends an empty extension that announces a capability, TLV_COMPACT or TLV_ACKS
+*
+*	@return
+*		Number of bytes written
+*
+*/
+
+int serialize_flag_tlv(void *buf,uint16_t type){
+	uint16_t tlv_type=htons(type);
+	uint16_t tlv_len=0;
+
+	memcpy(buf,&tlv_type,2);
+	memcpy(buf+2,&tlv_len,2);
+	return 4;
+}
+
+/*
+*
+*	Writes value as a little endian base 128 varint
+*
+*	@return
+*		Number of bytes written, at most 10
+*
+*/
+int put_varint(uint8_t *buf,uint64_t value){
+	int len=0;
+
+	while(value>=0x80){
+		buf[len++]=value|0x80;
+		value>>=7;
+	}
+	buf[len++]=value;
+	return len;
+}
+
+/*
+*
+*	Reads a varint written by put_varint()
+*
+*	@return
+*		First byte after the varint, NULL if it runs past end
+*
+*/
+uint8_t * get_varint(uint8_t *cur,uint8_t *end,uint64_t *value){
+	int shift;
+
+	*value=0;
+	for(shift=0;shift<64 && cur<end;shift+=7){
+		*value|=(uint64_t)(*cur&0x7f)<<shift;
+		if((*cur++&0x80)==0)
+			return cur;
+	}
+	return NULL;
+}
+
+/*
+*
+*	Serializes my distance vector as a PKT_COMPACT update. IPs, ports and ids are
+*	left out: entries are the costs of ids 1..num_of_servers in order, each a varint
+*	of cost<<1, and runs of unreachable servers collapse into one varint of
+*	run<<1|COMPACT_RUN. Written straight from adj_matrix, without prepare_update_pkt().
+*	In area mode the entries are the advertised ones in servers order, which every
+*	router of my area lists the same way.
+*
+*	@param buf
+*		Serialized packet, at least MAX_PKT_SIZE bytes
+*
+*	@return
+*		Number of bytes written
+*
+*/
+
+int serialize_compact_packet(void *buf){
+	uint8_t *cur=buf;
+	uint16_t id=htons(my_id);
+	metric_t *row=adj_matrix[my_index];
+	int j,run,count=0;
+
+	cur[0]=PKT_MAGIC;
+	cur[1]=PKT_COMPACT;
+	memcpy(cur+2,&id,2);
+	cur+=4;
+	for(j=0;j<num_of_servers;j++)
+		count+=is_advertised(j);
+	cur+=put_varint(cur,count);
+
+	for(j=0;j<num_of_servers;){
+		if(!is_advertised(j))
+			j++;
+		else if(row[j]>=metric_infinity){
+			for(run=0;j<num_of_servers && (row[j]>=metric_infinity || !is_advertised(j));j++)
+				run+=is_advertised(j);
+			cur+=put_varint(cur,(uint64_t)run<<1|COMPACT_RUN);
+		}
+		else
+			cur+=put_varint(cur,(uint64_t)row[j++]<<1);
+	}
+
+	cur+=serialize_interval_tlv(cur);
+	if(unchanged_keepalives)
+		cur+=serialize_version_tlv(cur);
+	if(restart_window_ms>0)
+		cur+=serialize_restart_tlv(cur);
+	if(reliable_rto_ms>0)
+		cur+=serialize_flag_tlv(cur,TLV_ACKS);
+	cur+=serialize_prefix_tlv(cur,MAX_PKT_SIZE-(cur-(uint8_t*)buf)-TLV_SEQ_SIZE);
+
+	memset(cur,0,4); // TLV_END
+	cur+=4;
+
+	return cur-(uint8_t*)buf;
+}
+
+/*
+*
+*	Appends the TLV_INTERVAL extension with the current periodic interval
+*
+*	@return
+*		Number of bytes written
+*
+*/
+
+int serialize_interval_tlv(void *buf){
+	uint16_t tlv_type=htons(TLV_INTERVAL);
+	uint16_t tlv_len=htons(4);
+	uint32_t interval=htonl(current_interval_ms);
+
+	memcpy(buf,&tlv_type,2);
+	memcpy(buf+2,&tlv_len,2);
+	memcpy(buf+4,&interval,4);
+	return 8;
+}
+
+/*
+*
+*	Appends the TLV_VERSION extension with the version of my vector
+*
+*	@return
+*		Number of bytes written
+*
+*/
+
+int serialize_version_tlv(void *buf){
+	uint16_t tlv_type=htons(TLV_VERSION);
+	uint16_t tlv_len=htons(4);
+	uint32_t version=htonl(vector_version);
+
+	memcpy(buf,&tlv_type,2);
+	memcpy(buf+2,&tlv_len,2);
+	memcpy(buf+4,&version,4);
+	return 8;
+}
+
+/*
+*
+*	Appends the TLV_RESTART extension with the restart window
+*
+*	@return
+*		Number of bytes written
+*
+*/
+
+int serialize_restart_tlv(void *buf){
+	uint16_t tlv_type=htons(TLV_RESTART);
+	uint16_t tlv_len=htons(4);
+	uint32_t window=htonl(restart_window_ms);
 
-		memcpy(cur,&packet_to_send->updates[j].server_id,sizeof(uint16_t));
-		cur+=2;
+	memcpy(buf,&tlv_type,2);
+	memcpy(buf+2,&tlv_len,2);
+	memcpy(buf+4,&window,4);
+	return 8;
+}
 
-		memcpy(cur,&packet_to_send->updates[j].cost,sizeof(uint16_t));
-		cur+=2;
+/*
+*
+*	Appends the TLV_PREFIXES extension with every prefix this server knows, own and learned,
+*	empty if it knows none so that neighbors withdraw what they learned from it
+*
+*	@param buf
+*		Where the TLV is written
+*
+*	@param space
+*		Bytes available in buf, nothing is written if there is no room for a prefix
+*
+*	@return
+*		Number of bytes written
+*
+*/
 
+int serialize_prefix_tlv(void *buf,int space){
+	uint16_t tlv_type, tlv_len, server_id;
+	uint32_t prefix;
+	int i,count,in_area;
+	void *cur=buf;
+	struct server *dest;
+
+	count=fib.num_of_prefixes;
+	if(space<4+TLV_PREFIX_ENTRY_SIZE+4)
+		return 0;
+	if(4+count*TLV_PREFIX_ENTRY_SIZE+4>space) // leave room for TLV_END
+		count=(space-8)/TLV_PREFIX_ENTRY_SIZE;
+
+	tlv_type=htons(TLV_PREFIXES);
+	tlv_len=htons(count*TLV_PREFIX_ENTRY_SIZE);
+	memcpy(cur,&tlv_type,2);
+	memcpy(cur+2,&tlv_len,2);
+	cur+=4;
+
+	for(i=0;i<count;i++){
+		dest=&servers[fib.prefixes[i].dest];
+		in_area=dest->area==my_area; // else summarized, like in the distance vector
+		server_id=htons(in_area ? dest->server_id : dest->area);
+		prefix=htonl(fib.prefixes[i].prefix);
+		memcpy(cur,&server_id,2);
+		((uint8_t*)cur)[2]=fib.prefixes[i].len;
+		((uint8_t*)cur)[3]=in_area ? 0 : PREFIX_AREA;
+		memcpy(cur+4,&prefix,4);
+		cur+=TLV_PREFIX_ENTRY_SIZE;
 	}
-	
+
+	return cur-buf;
 }
 
 /*
@@ -561,173 +2167,904 @@ void print_my_neighbors(){
 
 /*
 *
-*	Prints all the distance vectors
+*	Prints all the distance vectors
+*
+*/
+
+
+void display_all_distance_vectors(){
+	printf("All distance vectors\n");
+	int i,j;
+	for (i = 0; i < num_of_servers; i++){
+		printf("Server ");
+		print_server_id(i);
+		printf("\t");
+		for (j = 0; j < num_of_servers; j++){
+			printf ("%lu\t\t\t", (unsigned long)adj_matrix[i][j]); 
+		} 
+		printf ("\n"); 
+	}
+
+}
+
+
+/*
+*
+*	Prints the routing table
+*
+*/
+
+void display_routes(){
+	int i,protected=0;
+	printf("Server ID\t Cost\t Next Hop\t Equal Cost Next Hops\t Backup\n");
+	for (i = 0; i < num_of_servers; i++){
+		print_server_id(i);
+		printf ("\t %lu\t %d\t ",(unsigned long)servers[i].cost,servers[i].next_hop); 
+		print_next_hops(servers[i].next_hops,servers[i].num_of_next_hops);
+		if(servers[i].backup>=0){
+			printf("\t %d",servers[servers[i].backup].server_id);
+			protected++;
+		}
+		else
+			printf("\t -");
+		if(servers[i].link_damp.suppressed)
+			printf ("\t link damped (penalty %.0f)",damp_penalty(&servers[i].link_damp));
+		if(servers[i].route_damp.suppressed)
+			printf ("\t route damped (penalty %.0f)",damp_penalty(&servers[i].route_damp));
+		if(servers[i].restart_until_ms>0)
+			printf ("\t restarting (kept for %lld ms)",servers[i].restart_until_ms-now_ms());
+		printf ("\n");
+	}
+	printf("Loop-free alternates: %d routes protected, %lu failovers\n",protected,lfa_failovers);
+	if(damp_half_life_ms>0)
+		printf("Damping: %lu suppressions, %lu recomputes and %lu triggered sends avoided\n",suppress_events,recomputes_avoided,sends_avoided);
+
+}
+
+/*
+*
+*	Prints a next hop set as a comma separated list, "-" if empty
+*
+*/
+
+void print_next_hops(uint16_t *hops,int count){
+	int i;
+	if(count==0)
+		printf("-");
+	for(i=0;i<count;i++)
+		printf(i==0 ? "%d" : ",%d",hops[i]);
+}
+
+/*
+*
+*	Prints the ID of servers[index], "area N" for a remote area
+*
+*/
+
+void print_server_id(int index){
+	if(servers[index].is_area)
+		printf("area %d",servers[index].area);
+	else
+		printf("%d",servers[index].server_id);
+}
+
+/*
+*
+*	Prints information about all servers
+*
+*/
+
+void print_all_servers(){
+	int i;
+	for(i=0;i<first_area_index;i++){
+		char ip_presentation[15];
+		
+		printf("----------\n");
+		printf("Server ID: %d \n",servers[i].server_id);
+		inet_ntop(AF_INET,&servers[i].server_ip,ip_presentation,sizeof(ip_presentation));
+		printf("Server IP: %s \n",ip_presentation);
+		printf("Server Port: %d \n",servers[i].server_port);
+		printf("----------\n");
+
+	}
+}
+
+/*
+*
+*	Finds the sender of a distance vector packet, legacy or PKT_COMPACT, without
+*	decoding it. Only reads the configuration, safe from receive threads.
+*
+*	@return
+*		Index of the sender in servers, -1 if unknown
+*
+*/
+
+int pkt_sender(void * packet,int pkt_len){
+	int i,sender=-1;
+	uint16_t server_port;
+	uint32_t server_ip;
+	uint16_t sender_id;
+
+	if(pkt_len>=2 && ((uint8_t*)packet)[0]==PKT_MAGIC){
+		if(pkt_len<5 || ((uint8_t*)packet)[1]!=PKT_COMPACT)
+			return -1;
+		memcpy(&sender_id,packet+2,2);
+		sender=server_index(ntohs(sender_id));
+		if(sender<0 || sender==my_index || servers[sender].area!=my_area) // other areas list other entries
+			return -1;
+		return sender;
+	}
+
+	if(pkt_len<8)
+		return -1;
+	memcpy(&server_port,packet+2,2);
+	memcpy(&server_ip,packet+4,4);
+	for(i=0;i<first_area_index;i++){
+		if(ntohl(server_ip)==servers[i].server_ip && ntohs(server_port)==servers[i].server_port) // port tells apart servers sharing a host
+			sender=i;
+	}
+	return sender;
+}
+
+/*
+*
+*	Marks what a full vector from sender says about it until its TLVs say otherwise
+*
+*	@param compact
+*		1 if the vector came as PKT_COMPACT
+*
+*/
+
+void vector_received(int sender,int compact){
+	servers[sender].peer_compact=compact;
+	servers[sender].peer_acks=0;
+	servers[sender].peer_versions=0;
+	servers[sender].heard_version=0;
+	restart_over(sender);
+}
+
+/*
+*
+*	Processes the received update packet 
+*
+*	@param packet
+*		Packet to be processed
+*
+*	@param pkt_len
+*		Number of bytes received
+*
+*	@return
+*		Sender's ID, 0 if the sender is unknown
+*
+*/
+
+uint16_t process_pkt(void * packet,int pkt_len){
+	int sender=pkt_sender(packet,pkt_len);
+	void * tlvs;
+
+	if(sender<0)
+		return 0;
+	tlvs=decode_pkt(packet,pkt_len,sender,adj_matrix[sender],&entries_changed);
+	if(tlvs==NULL)
+		return 0;
+	vector_received(sender,0);
+	process_tlvs(servers[sender].server_id,tlvs,packet+pkt_len);
+
+	return servers[sender].server_id;
+
+}
+
+/*
+*
+*	Decodes the distance vectors of a legacy update packet into a row
+*
+*	@param sender
+*		Index of the sender in servers, from pkt_sender()
+*
+*	@param row
+*		Sender's row of adj_matrix, or a receive thread's copy of it
+*
+*	@param changed
+*		Incremented per entry that changed
+*
+*	@return
+*		First byte of the TLVs, NULL if the packet is malformed
+*
+*/
+
+void * decode_pkt(void * packet,int pkt_len,int sender,metric_t *row,int *changed){
+	int i;
+	void * pkt_end=packet+pkt_len;
+	uint16_t server_count;
+	uint16_t padding;
+	uint16_t server_id;
+	uint16_t server_cost;	
+	metric_t cost;
+
+	memcpy(&server_count,packet,2);
+	packet=packet+8;
+	/*
+	printf("-----Header-----\n");
+	printf("%d\n",ntohs(server_count));
+	printf("-----Update-----\n");
+	*/
+
+
+	if(packet+12*ntohs(server_count)>pkt_end)
+		return NULL;
+	for(i=first_area_index;i<num_of_servers;i++) // summaries are the cheapest entry seen in this vector
+		row[i]=metric_infinity;
+
+	for(i=0;i<ntohs(server_count);i++){
+			packet=packet+6; // IP and port, the ID names the server
+
+			memcpy(&padding,packet,2); // 0x0, or ENTRY_AREA
+			packet=packet+2;
+
+			memcpy(&server_id,packet,2);
+			//printf("%d\t",ntohs(server_id));
+			packet=packet+2;
+
+			memcpy(&server_cost,packet,2);
+			//printf("%d\t\n",ntohs(server_cost));
+
+			packet=packet+2;
+
+			//printf("\n\n");
+
+
+			if(areas_enabled){
+				learn_area_entry(sender,row,ntohs(padding),ntohs(server_id),metric_from_wire(ntohs(server_cost)),changed);
+				continue;
+			}
+			if(ntohs(server_id)<1 || ntohs(server_id)>num_of_servers)
+				continue;
+			cost=metric_from_wire(ntohs(server_cost));
+			if(row[ntohs(server_id)-1]!=cost){
+				row[ntohs(server_id)-1]=cost;
+				(*changed)++;
+			}
+	}
+
+	return packet;
+}
+
+/*
+*
+*	Stores one legacy distance vector entry in area mode. A sender in my area lists
+*	servers of my area and remote area summaries; a sender in another area lists
+*	servers of its own area, which only lower its summary cost of that area.
+*
+*	@param sender
+*		Index of the sender in servers
+*
+*	@param row
+*		Where the sender's vector is decoded to
+*
+*	@param flags
+*		Padding field of the entry, ENTRY_AREA or 0
+*
+*/
+
+void learn_area_entry(int sender,metric_t *row,uint16_t flags,uint16_t id,metric_t cost,int *changed){
+	int index,area;
+
+	if(flags&ENTRY_AREA){
+		if(id==my_area) // I know my own area in detail
+			return;
+		area=area_index(id);
+	}
+	else if(servers[sender].area==my_area){
+		index=server_index(id);
+		if(index>=0 && servers[index].area==my_area && row[index]!=cost){
+			row[index]=cost;
+			(*changed)++;
+		}
+		return;
+	}
+	else{
+		index=server_index(id);
+		if(index>=0 && servers[index].area==servers[sender].area) // one of my neighbors in that area
+			row[index]=cost;
+		area=area_index(servers[sender].area);
+	}
+	if(area>=0 && cost<row[area])
+		row[area]=cost;
+}
+
+/*
+*
+*	Deserializes a PKT_COMPACT update into the sender's row of adj_matrix
+*
+*	@param packet
+*		Received packet, starting with PKT_MAGIC
+*
+*	@return
+*		Sender's ID, 0 if the sender is unknown or the packet is malformed
+*
+*/
+
+uint16_t process_compact_pkt(void * packet,int pkt_len){
+	int sender=pkt_sender(packet,pkt_len);
+	void * tlvs;
+
+	if(sender<0)
+		return 0;
+	tlvs=decode_compact_pkt(packet,pkt_len,adj_matrix[sender],&entries_changed);
+	if(tlvs==NULL)
+		return 0;
+	vector_received(sender,1);
+	process_tlvs(servers[sender].server_id,tlvs,packet+pkt_len);
+
+	return servers[sender].server_id;
+}
+
+/*
+*
+*	Decodes the costs of a PKT_COMPACT update into a row
+*
+*	@param row
+*		Sender's row of adj_matrix, or a receive thread's copy of it
+*
+*	@param changed
+*		Incremented per entry that changed
+*
+*	@return
+*		First byte of the TLVs, NULL if the packet is malformed
+*
+*/
+
+void * decode_compact_pkt(void * packet,int pkt_len,metric_t *row,int *changed){
+	uint8_t *cur=packet,*pkt_end=cur+pkt_len;
+	uint64_t count,token,run,j=0,k,end;
+	metric_t cost;
+
+	cur=get_varint(cur+4,pkt_end,&count);
+	if(cur==NULL)
+		return NULL;
+
+	while(j<count){ // entry j goes to advertised[j], entries past my own list are skipped
+		if(cur<pkt_end && *cur<0x80) // one byte token: costs below 64 and runs below 64
+			token=*cur++;
+		else if((cur=get_varint(cur,pkt_end,&token))==NULL)
+			return NULL;
+
+		if(token&COMPACT_RUN){
+			run=token>>1;
+			if(run>count-j)
+				return NULL;
+			end=j+run<(uint64_t)num_of_advertised ? j+run : (uint64_t)num_of_advertised;
+			for(k=j;k<end;k++){
+				if(row[advertised[k]]!=metric_infinity){
+					row[advertised[k]]=metric_infinity;
+					(*changed)++;
+				}
+			}
+			j+=run;
+			continue;
+		}
+
+		cost=(token>>1)>=metric_infinity ? metric_infinity : token>>1;
+		if(j<(uint64_t)num_of_advertised && row[advertised[j]]!=cost){
+			row[advertised[j]]=cost;
+			(*changed)++;
+		}
+		j++;
+	}
+
+	return cur;
+}
+
+/*
+*
+*	Processes the extension TLVs that follow the distance vectors
+*
+*	@param sender_id
+*		Server that sent the packet
+*
+*	@param packet
+*		First byte after the distance vectors
+*
+*	@param pkt_end
+*		One past the last byte received
+*
+*/
+
+void process_tlvs(uint16_t sender_id,void * packet,void * pkt_end){
+	uint16_t tlv_type,tlv_len;
+	uint32_t interval,seq,version,window;
+	int sender=server_index(sender_id);
+
+	while(packet+4<=pkt_end){
+		memcpy(&tlv_type,packet,2);
+		memcpy(&tlv_len,packet+2,2);
+		tlv_type=ntohs(tlv_type);
+		tlv_len=ntohs(tlv_len);
+		packet=packet+4;
+
+		if(tlv_type==TLV_END || packet+tlv_len>pkt_end)
+			break;
+		if(tlv_type==TLV_PREFIXES)
+			process_prefix_tlv(sender,packet,tlv_len);
+		if(tlv_type==TLV_INTERVAL && tlv_len==4){
+			memcpy(&interval,packet,4);
+			servers[sender].update_interval_ms=ntohl(interval);
+		}
+		if(tlv_type==TLV_COMPACT)
+			servers[sender].peer_compact=1;
+		if(tlv_type==TLV_ACKS)
+			servers[sender].peer_acks=1;
+		if(tlv_type==TLV_VERSION && tlv_len==4){
+			memcpy(&version,packet,4);
+			servers[sender].heard_version=ntohl(version);
+			servers[sender].peer_versions=1;
+		}
+		if(tlv_type==TLV_RESTART && tlv_len==4 && servers[sender].is_neighbor==1 && servers[sender].is_alive==1){
+			memcpy(&window,packet,4);
+			servers[sender].restart_until_ms=now_ms()+ntohl(window);
+			servers[sender].sent_version=0; // it comes back knowing nothing
+			servers[sender].heard_version=0;
+			servers[sender].ack_seq=0;
+			drop_in_flight(sender);
+			printf("Server %d is restarting, keeping its routes for %u ms\n",sender_id,ntohl(window));
+		}
+		if(tlv_type==TLV_SEQ && tlv_len==4){
+			memcpy(&seq,packet,4);
+			note_seq(sender,ntohl(seq));
+		}
+		packet=packet+tlv_len;
+	}
+
+	if(fib.dirty){
+		fib_rebuild(&fib);
+		refresh_fib();
+	}
+}
+
+/*
+*
+*	Learns the prefixes advertised for every origin server in a TLV_PREFIXES value.
+*	Prefixes of an origin are replaced as a set; our own prefixes are never overwritten.
+*	Origins this sender listed before and left out now lose theirs, all of them if the
+*	TLV is empty.
+*	In area mode prefixes of servers I do not track belong to the sender's area.
+*
+*	@param sender
+*		Index of the sender in servers
+*
+*/
+
+void process_prefix_tlv(int sender,void * value,int len){
+	struct fib_prefix * learned;
+	uint16_t entry_origin;
+	uint32_t prefix;
+	int i,k,d,dest,count,num_of_entries=len/TLV_PREFIX_ENTRY_SIZE,listed=0,stale;
+	int *dests;
+	static uint32_t prefix_tlvs;
+
+	learned=(struct fib_prefix *)malloc(sizeof(struct fib_prefix)*(num_of_entries+1));
+	dests=(int*)malloc(sizeof(int)*(num_of_entries+1));
+	prefix_tlvs++;
+
+	for(i=0;i<num_of_entries;i++){
+		memcpy(&entry_origin,value+i*TLV_PREFIX_ENTRY_SIZE,2);
+		entry_origin=ntohs(entry_origin);
+		if(((uint8_t*)value)[i*TLV_PREFIX_ENTRY_SIZE+3]&PREFIX_AREA)
+			dests[i]=entry_origin==my_area ? -1 : area_index(entry_origin);
+		else if((dests[i]=server_index(entry_origin))<0 && areas_enabled && servers[sender].area!=my_area)
+			dests[i]=area_index(servers[sender].area);
+	}
+
+	for(i=0;i<num_of_entries;i++){
+		dest=dests[i];
+		if(dest<0 || dest==my_index)
+			continue;
+		count=0;
+		for(k=i;k<num_of_entries;k++){
+			if(dests[k]!=dest)
+				continue;
+			dests[k]=-1; // done with this origin
+			memcpy(&prefix,value+k*TLV_PREFIX_ENTRY_SIZE+4,4);
+			learned[count].prefix=ntohl(prefix);
+			learned[count].len=((uint8_t*)value)[k*TLV_PREFIX_ENTRY_SIZE+2];
+			learned[count].dest=dest;
+			for(d=0;d<count;d++){ // a neighbor can list an area prefix under several of its destinations
+				if(learned[d].prefix==learned[count].prefix && learned[d].len==learned[count].len)
+					break;
+			}
+			if(learned[count].len<=32 && d==count)
+				count++;
+		}
+		fib_replace_dest_prefixes(&fib,dest,learned,count);
+		listed++;
+		if(servers[dest].prefix_source!=sender){
+			if(servers[dest].prefix_source>=0)
+				servers[servers[dest].prefix_source].num_of_prefix_origins--;
+			servers[dest].prefix_source=sender;
+			servers[sender].num_of_prefix_origins++;
+		}
+		servers[dest].prefix_tlv=prefix_tlvs;
+	}
+
+	stale=servers[sender].num_of_prefix_origins-listed; // set by this sender before, not listed any more
+	for(dest=0;stale>0 && dest<num_of_servers;dest++){
+		if(servers[dest].prefix_source==sender && servers[dest].prefix_tlv!=prefix_tlvs){
+			fib_replace_dest_prefixes(&fib,dest,NULL,0);
+			servers[dest].prefix_source=-1;
+			servers[sender].num_of_prefix_origins--;
+			stale--;
+		}
+	}
+
+	free(dests);
+	free(learned);
+}
+
+/*
+*
+*	Copies next hops from the routing table into the forwarding table.
+*	Only next hop slots change; the prefix trie is rebuilt only when prefixes change.
 *
 */
 
+void refresh_fib(){
+	int i,count;
 
-void display_all_distance_vectors(){
-	printf("All distance vectors\n");
-	int i,j;
-	for (i = 0; i < num_of_servers; i++){
-		printf("Server %d\t",servers[i].server_id);
-		for (j = 0; j < num_of_servers; j++){
-			printf ("%d\t\t\t", adj_matrix[i][j]); 
-		} 
-		printf ("\n"); 
+	for(i=0;i<num_of_servers;i++){
+		count=servers[i].num_of_next_hops;
+		if(servers[i].cost==metric_infinity)
+			count=0;
+		if(fib.next_hops[i].count!=count || memcmp(fib.next_hops[i].hops,servers[i].next_hops,count*sizeof(uint16_t))!=0)
+			fib_set_next_hops(&fib,i,servers[i].next_hops,count);
 	}
-
 }
 
-
 /*
 *
-*	Prints the routing table
+*	Prints the forwarding table
 *
 */
 
-void display_routes(){
-	int i,j;
-	printf("Server ID\t Cost\t Next Hop\n");
-	for (i = 0; i < num_of_servers; i++){
-		printf ("%d\t %d\t %d\n",servers[i].server_id,servers[i].cost,servers[i].next_hop); 
+void display_fib(){
+	int i;
+	char ip_presentation[INET_ADDRSTRLEN];
+	uint32_t prefix;
+
+	printf("Prefix\t\t\t Server ID\t Next Hops\n");
+	for(i=0;i<fib.num_of_prefixes;i++){
+		prefix=htonl(fib.prefixes[i].prefix);
+		inet_ntop(AF_INET,&prefix,ip_presentation,sizeof(ip_presentation));
+		printf("%s/%d\t\t ",ip_presentation,fib.prefixes[i].len);
+		print_server_id(fib.prefixes[i].dest);
+		printf("\t\t ");
+		print_next_hops(fib.next_hops[fib.prefixes[i].dest].hops,fib.next_hops[fib.prefixes[i].dest].count);
+		printf("\n");
 	}
-
 }
 
 /*
 *
-*	Prints information about all servers
+*	Adds the prefixes given with -p to the forwarding table
 *
 */
 
-void print_all_servers(){
-	int i;
-	for(i=0;i<num_of_servers;i++){
-		char ip_presentation[15];
-		
-		printf("----------\n");
-		printf("Server ID: %d \n",servers[i].server_id);
-		inet_ntop(AF_INET,&servers[i].server_ip,ip_presentation,sizeof(ip_presentation));
-		printf("Server IP: %s \n",ip_presentation);
-		printf("Server Port: %d \n",servers[i].server_port);
-		printf("----------\n");
+void add_own_prefixes(){
+	int i,len;
+	uint32_t prefix;
 
+	fib_init(&fib,num_of_servers);
+	for(i=0;i<num_of_own_prefixes;i++){
+		if(fib_parse_prefix(own_prefixes[i],&prefix,&len)<0){
+			printf("Invalid prefix %s \n",own_prefixes[i]);
+			exit(0);
+		}
+		fib_add_prefix(&fib,prefix,len,my_index);
 	}
+	fib_rebuild(&fib);
+	refresh_fib();
 }
 
 /*
 *
-*	Processes the received update packet 
+*	Deserialized the received packet
 *
 *	@param packet
-*		Packet to be processed
-*
-*	@return
-*		Sender's ID
+*		Packet to be deserialized
 *
 */
 
-uint16_t process_pkt(void * packet){
-	int i;
-	uint16_t server_count;
-	uint16_t server_port;
-	uint32_t server_ip;
-	uint16_t server_id;
-	uint16_t server_cost;	
+void deserialize_pkt(void * packet,int pkt_len){
 
 	uint16_t sender_id;
-
-
-	memcpy(&server_count,packet,2);
-	packet=packet+2;
-	memcpy(&server_port,packet,2);
-	packet=packet+2;
-	memcpy(&server_ip,packet,4);
-	packet=packet+4;
-
-	for(i=0;i<num_of_servers;i++){
-		if(ntohl(server_ip)==servers[i].server_ip){
-			sender_id=servers[i].server_id;
-			
+	int sender;
+	int64_t start_ns=event_tracing ? event_clock_ns() : 0;
+
+	entries_changed=0;
+	if(pkt_len>=2 && ((uint8_t*)packet)[0]==PKT_MAGIC){ // extension packet
+		if(((uint8_t*)packet)[1]==PKT_HELLO){
+			process_hello(packet,pkt_len);
+			return;
 		}
+		if(((uint8_t*)packet)[1]==PKT_ACK){
+			process_ack(packet,pkt_len);
+			return;
+		}
+		if(((uint8_t*)packet)[1]==PKT_UNCHANGED){
+			process_unchanged(packet,pkt_len);
+			return;
+		}
+		if(((uint8_t*)packet)[1]==PKT_RESYNC){
+			process_resync(packet,pkt_len);
+			return;
+		}
+		if(((uint8_t*)packet)[1]!=PKT_COMPACT)
+			return;
+		sender_id=process_compact_pkt(packet,pkt_len);
 	}
-	/*
-	printf("-----Header-----\n");
-	printf("%d\t%d\n",ntohs(server_count),ntohs(server_port));
-	printf("%d\n",ntohl(server_ip));
-	printf("-----Update-----\n");
-	*/
-
+	else
+		sender_id=process_pkt(packet,pkt_len);
+	if(sender_id==0){
+		if(!quiet)
+			printf("PACKET FROM UNKNOWN SERVER DISCARDED\n");
+		return;
+	}
+	sender=server_index(sender_id);
 
-	for(i=0;i<ntohs(server_count);i++){
-			memcpy(&server_ip,packet,4);
-			//printf("%d\n",ntohl(server_ip));
-			packet=packet+4;
+	if(accept_vector(sender,pkt_len,start_ns)){
+		bellman_ford();
+		event_cause=0;
+	}
+	schedule_ack(sender);
+}
 
-			memcpy(&server_port,packet,2);
-			//printf("%d\t",ntohs(server_port));
-			packet=packet+2;
+/*
+*
+*	Takes a decoded vector into account: brings back a dead neighbor, and counts the
+*	sender as heard from if it is a live neighbor
+*
+*	@param start_ns
+*		When receiving the vector started, for the trace
+*
+*	@return
+*		1 if routes have to be recomputed, 0 if the vector is kept or discarded without
+*
+*/
 
-			//printf("0x0\n");
+int accept_vector(int sender,int pkt_len,int64_t start_ns){
+	uint16_t sender_id=servers[sender].server_id;
 
-			packet=packet+2;
+	if(servers[sender].is_alive==0 && servers[sender].link_cost!=metric_infinity){ // a dead neighbor came back
+		if(!quiet)
+			printf("SERVER %d IS BACK\n",sender_id);
+		if(damp_event(&servers[sender].link_damp,DAMP_CHANGE_PENALTY)){
+			servers[sender].is_alive=1; // reinstated by release_damped_links()
+			servers[sender].is_neighbor=1;
+		}
+		else{
+			neighbor_up(sender);
+			note_route_change();
+		}
+	}
 
-			memcpy(&server_id,packet,2);
-			//printf("%d\t",ntohs(server_id));
-			packet=packet+2;
+	if(servers[sender].link_damp.suppressed && servers[sender].is_neighbor==1){ // keep the vector, skip the recompute
+		if(!quiet)
+			printf("RECEIVED A MESSAGE FROM DAMPED SERVER %d\n",sender_id);
+		recomputes_avoided++;
+		reset_skip_flag(sender_id);
+		servers[sender].last_heard_ms=now_ms();
+		return 0;
+	}
+	if(servers[sender].is_alive==1 && servers[sender].is_neighbor==1){ // accept packet only if its from an active and neighnor server
+		if(!quiet)
+			printf("RECEIVED A MESSAGE FROM SERVER %d\n",sender_id);
+		if(event_tracing){
+			event_cause=event_next_id();
+			event_record(EVENT_RECV,start_ns,sender_id,entries_changed,0,event_cause);
+		}
 
-			memcpy(&server_cost,packet,2);
-			//printf("%d\t\n",ntohs(server_cost));
+		num_of_pkts_received++;
+		interval_stats.pkts_received++;
+		interval_stats.bytes_received+=pkt_len;
 
-			packet=packet+2;
+		reset_skip_flag(sender_id);
+		servers[sender].last_heard_ms=now_ms();
+		return 1;
+	}
+	//discard packet
+	if(!quiet)
+		printf("PACKET FROM SERVER %d DISCARDED\n",sender_id);
+	return 0;
+}
 
-			//printf("\n\n");
+/*
+*
+*	Schedules an ack of the reliable update just processed, if the sender asked for
+*	one. Acks wait ACK_DELAY_MS so the updates of a burst are acked together.
+*
+*/
 
+void schedule_ack(int sender){
+	if(servers[sender].ack_pending){
+		servers[sender].ack_pending=0;
+		if(servers[sender].is_neighbor==1){ // kept, even if damped
+			servers[sender].ack_due=1;
+			if(next_ack_ms==0)
+				next_ack_ms=now_ms()+ACK_DELAY_MS;
+		}
+	}
+}
 
-			adj_matrix[sender_id-1][ntohs(server_id)-1]=ntohs(server_cost);
-			
+/*
+*
+*	Sends the acks scheduled by schedule_ack()
+*
+*/
+void send_due_acks(){
+	int i;
 
+	for(i=0;i<num_of_servers;i++){
+		if(servers[i].ack_due){
+			servers[i].ack_due=0;
+			if(servers[i].is_neighbor==1)
+				send_ack(i);
+		}
+	}
+	next_ack_ms=0;
+}
 
+/*
+*
+*	Opens the capture file for appending, writing the trace header if the file is new
+*
+*	@param file_name
+*		Trace file name
+*
+*	@return
+*		Integer indicating success/failure of function
+*
+*/
 
+int open_capture_file(char * file_name){
+	struct trace_header header;
 
+	capture_file=fopen(file_name,"ab");
+	if(capture_file==NULL){
+		perror("capture file");
+		return -1;
 	}
+	if(ftell(capture_file)==0){
+		memcpy(header.magic,TRACE_MAGIC,4);
+		header.version=TRACE_VERSION;
+		header.my_id=my_id;
+		fwrite(&header,sizeof(header),1,capture_file);
+	}
+	return 1;
+}
 
-	return sender_id;
+/*
+*
+*	Appends a received datagram to the capture file
+*
+*	@param packet
+*		Datagram as received
+*
+*	@param pkt_len
+*		Number of bytes received
+*
+*	@param src
+*		Address the datagram came from
+*
+*/
 
+void capture_pkt(void * packet,int pkt_len,struct sockaddr_in * src){
+	struct trace_record record;
+	struct timespec ts;
+
+	clock_gettime(CLOCK_REALTIME,&ts);
+	record.time_us=(uint64_t)ts.tv_sec*1000000+ts.tv_nsec/1000;
+	record.src_ip=ntohl(src->sin_addr.s_addr);
+	record.src_port=ntohs(src->sin_port);
+	record.len=pkt_len;
+	flockfile(capture_file); // receive shard threads capture too
+	fwrite(&record,sizeof(record),1,capture_file);
+	fwrite(packet,pkt_len,1,capture_file);
+	funlockfile(capture_file);
 }
 
 /*
 *
-*	Deserialized the received packet
+*	Decides if a topology file entry describes this server: the entry with the --id ID,
+*	else the entry with the --bind address, else the first entry on a local interface.
+*	With both --id and --bind, parse_topology_file() checks that they name the same entry.
 *
-*	@param packet
-*		Packet to be deserialized
+*	@param server_id
+*		ID of the entry
+*
+*	@param server_ip
+*		IP address of the entry
 *
 */
 
-void deserialize_pkt(void * packet){
+int is_me(int server_id,char * server_ip){
+	if(requested_id!=0)
+		return server_id==requested_id;
+	if(bind_ip!=NULL)
+		return strcmp(bind_ip,server_ip)==0;
+	return is_local_ip(inet_addr(server_ip));
+}
 
-	uint16_t sender_id;
-	sender_id=process_pkt(packet);
+/*
+*
+*	Returns the index of a server in servers, -1 if it is not tracked. IDs are
+*	dense without areas; in area mode they go through index_table.
+*
+*/
 
-	if(servers[sender_id-1].is_alive==1 && servers[sender_id-1].is_neighbor==1){ // accept packet only if its from an active and neighnor server
-		printf("RECEIVED A MESSAGE FROM SERVER %d\n",sender_id);
-		bellman_ford();
+int server_index(int server_id){
+	int slot;
 
-		num_of_pkts_received++;
+	if(!areas_enabled)
+		return (server_id>=1 && server_id<=num_of_servers) ? server_id-1 : -1;
+	for(slot=(server_id*2654435761u)&index_table_mask;index_table[slot]>=0;slot=(slot+1)&index_table_mask){
+		if(servers[index_table[slot]].server_id==server_id)
+			return index_table[slot];
+	}
+	return -1;
+}
 
-		reset_skip_flag(sender_id);
+/*
+*
+*	Returns the index of the summary entry of a remote area in servers, -1 if there is none
+*
+*/
+
+int area_index(int area){
+	int low=first_area_index,high=num_of_servers-1,middle;
+
+	while(low<=high){
+		middle=(low+high)/2;
+		if(servers[middle].area==area)
+			return middle;
+		if(servers[middle].area<area)
+			low=middle+1;
+		else
+			high=middle-1;
 	}
-	else{ //discard packet
-		printf("PACKET FROM SERVER %d DISCARDED\n",sender_id);
-		
+	return -1;
+}
+
+/*
+*
+*	Fills index_table from servers, at most half full
+*
+*/
+
+void build_index_table(){
+	int i,slot,size=4;
+
+	while(size<first_area_index*2)
+		size*=2;
+	free(index_table);
+	index_table=(int*)malloc(sizeof(int)*size);
+	index_table_mask=size-1;
+	for(i=0;i<size;i++)
+		index_table[i]=-1;
+	for(i=0;i<first_area_index;i++){
+		for(slot=(servers[i].server_id*2654435761u)&index_table_mask;index_table[slot]>=0;slot=(slot+1)&index_table_mask)
+			;
+		index_table[slot]=i;
 	}
 }
 
+static int compare_areas(const void *a,const void *b){
+	return *(const uint16_t*)a-*(const uint16_t*)b;
+}
+
 /*
 *
-*	Parses the topology file
+*	Parses the topology file. A 4th column on the server lines puts servers in
+*	areas; then only my area, my neighbors and one summary entry per remote area
+*	are tracked, so servers and adj_matrix grow with the area, not the network.
 *
 *	@param topology_file
 *		Topology file name
@@ -737,13 +3074,20 @@ void deserialize_pkt(void * packet){
 void parse_topology_file(char * topology_file){
 	char buffer[1024]; // to store line read from topology file
 	int num_of_neighbors;
+	int num_of_entries;
+	int num_of_areas=0;
 	int i,j;
 	int from;
 	int to;
-	int cost;
+	unsigned long cost;
 	int server_port;
 	int server_id;
 	char * server_ip;
+	char * area;
+	struct topology_entry *entries; // every server line
+	int *link_from,*link_to;
+	unsigned long *link_cost;
+	uint16_t *areas;
 
 
 	FILE* topology_file_ptr=fopen(topology_file, "r");
@@ -751,71 +3095,149 @@ void parse_topology_file(char * topology_file){
 		printf("Error opening file %s \n",topology_file);
 		exit(0);
 	}
-	/*
-	while(fgets (buffer, 1024, topology_file_ptr)){
-		printf("%s",buffer);
-	}
-	*/
+	my_id=0;
+	areas_enabled=0;
+	my_area=0;
 	fgets (buffer, 1024, topology_file_ptr);
-	num_of_servers=atoi(buffer);
+	num_of_entries=atoi(buffer);
 
 	fgets (buffer, 1024, topology_file_ptr);
 	num_of_neighbors=atoi(buffer);
 
-	//printf("Number of servers: %d\n",num_of_servers);
-	//printf("Number of neighbors: %d\n",num_of_neighbors);
-
 	//Start processing all servers 
 
-	servers = ( struct server *)malloc(sizeof(struct server) * num_of_servers);
-
+	entries=(struct topology_entry *)malloc(sizeof(struct topology_entry) * num_of_entries);
 
-	for(i=0;i<num_of_servers;i++){
+	for(i=0;i<num_of_entries;i++){
 
 
 		fgets(buffer, 1024, topology_file_ptr);
 		strtok(buffer," ");
 		server_id=atoi(buffer);
+		if(server_id<1 || server_id>USHRT_MAX){
+			printf("Server ID %d in topology file %s is outside 1..%d\n",server_id,topology_file,USHRT_MAX);
+			exit(0);
+		}
 		server_ip=strtok (NULL, " ");
-		server_port=atoi(strtok (NULL, " "));
-		if(strcmp(my_ip_raw,server_ip)==0){
+		server_port=atoi(strtok (NULL, " \r\n"));
+		area=strtok(NULL," \r\n");
+		if(my_id==0 && is_me(server_id,server_ip)){
+			if(bind_ip!=NULL && strcmp(bind_ip,server_ip)!=0){
+				printf("Server %d is at %s in topology file %s, not at the --bind address %s\n",server_id,server_ip,topology_file,bind_ip);
+				exit(0);
+			}
 			my_id=server_id;
+			free(my_ip_raw); // tools parse again and again
+			my_ip_raw=strdup(server_ip);
 			my_ip=inet_addr(server_ip);
 			my_port=server_port;
-			/*
-			printf("I am Server ID %d \n",my_id);
-			printf("I run on port %d \n",my_port);
-			printf("My IP address(network order) %d \n",my_ip);
-
-			inet_ntop(AF_INET,&my_ip,my_ip_raw,sizeof(my_ip_raw));
-			printf("My IP address(presentation) %s\n",my_ip_raw);
-			exit(0);
-			*/
 		}
 
-		servers[i].server_ip = malloc( sizeof(char) * ( 16 ) );
+		entries[i].server_id=server_id;
+		entries[i].server_ip=inet_addr(server_ip); //store char* ip address as unsigned int
+		entries[i].server_port=server_port;
+		entries[i].area=area!=NULL ? atoi(area) : 0;
+		entries[i].keep=1;
+		if(area!=NULL)
+			areas_enabled=1;
+		if(server_id==my_id)
+			my_area=entries[i].area;
+	}
 
-		servers[i].server_id=server_id;
-		servers[i].server_ip=inet_addr(server_ip); //store char* ip address as unsigned int
-		//inet_pton(AF_INET,server_ip,servers[i].server_ip);
-		servers[i].server_port=server_port;
-		servers[i].is_alive=1;
-		servers[i].num_of_skips=0;
-		servers[i].cost=USHRT_MAX;
-		servers[i].next_hop=-1;
-		servers[i].is_neighbor=0;
+	//End processing all servers
+
+	link_from=(int*)malloc(sizeof(int) * (num_of_neighbors+1));
+	link_to=(int*)malloc(sizeof(int) * (num_of_neighbors+1));
+	link_cost=(unsigned long*)malloc(sizeof(unsigned long) * (num_of_neighbors+1));
+	for(i=0;i<num_of_neighbors;i++){
 
+		fgets(buffer, 1024, topology_file_ptr);
+		link_from[i]=atoi(strtok(buffer," "));
+		link_to[i]=atoi(strtok(NULL," "));
+		link_cost[i]=strtoul(strtok(NULL," "),NULL,10);
+	}
+	fclose(topology_file_ptr);
 
+	if(my_id==0){
+		printf("This host is not in topology file %s, use --id or --bind\n",topology_file);
+		exit(0);
+	}
 
+	// in area mode keep my area and the ends of my links, and list the other areas
+	areas=(uint16_t*)malloc(sizeof(uint16_t) * (num_of_entries+1));
+	if(areas_enabled){
+		for(i=0;i<num_of_entries;i++){
+			entries[i].keep=entries[i].area==my_area;
+			for(j=0;j<num_of_neighbors && !entries[i].keep;j++)
+				entries[i].keep=(entries[i].server_id==link_from[j] || entries[i].server_id==link_to[j]);
+			if(entries[i].area!=my_area)
+				areas[num_of_areas++]=entries[i].area;
+		}
+		qsort(areas,num_of_areas,sizeof(uint16_t),compare_areas);
+		for(i=0,j=0;i<num_of_areas;i++){
+			if(j==0 || areas[j-1]!=areas[i])
+				areas[j++]=areas[i];
+		}
+		num_of_areas=j;
 	}
 
-	//End processing all servers
+	num_of_servers=num_of_areas;
+	for(i=0;i<num_of_entries;i++)
+		num_of_servers+=entries[i].keep;
+	servers = ( struct server *)calloc(num_of_servers, sizeof(struct server));
+
+	for(i=0,j=0;i<num_of_servers;i++){
+		if(i<num_of_servers-num_of_areas){
+			while(!entries[j].keep)
+				j++;
+			servers[i].server_id=entries[j].server_id;
+			servers[i].server_ip=entries[j].server_ip;
+			servers[i].server_port=entries[j].server_port;
+			servers[i].area=entries[j++].area;
+		}
+		else{ // remote area
+			servers[i].is_area=1;
+			servers[i].area=areas[i-(num_of_servers-num_of_areas)];
+		}
+		servers[i].is_alive=1;
+		servers[i].num_of_skips=0;
+		servers[i].cost=metric_infinity;
+		servers[i].next_hop=-1;
+		servers[i].num_of_next_hops=0;
+		servers[i].backup=-1;
+		servers[i].prefix_source=-1;
+		servers[i].found_cost=metric_infinity;
+		servers[i].next_seq=1; // ack_seq 0 means none
+		servers[i].is_neighbor=0;
+		servers[i].link_cost=metric_infinity;
+		memset(&servers[i].link_damp,0,sizeof(struct damping));
+		memset(&servers[i].route_damp,0,sizeof(struct damping));
+		servers[i].last_heard_ms=now_ms();
+		servers[i].update_interval_ms=0;
+		servers[i].last_hello_ms=0;
+		servers[i].hello_interval_ms=0;
+	}
+	first_area_index=num_of_servers-num_of_areas;
+	if(areas_enabled)
+		build_index_table();
+	my_index=server_index(my_id);
+	advertised=(int*)realloc(advertised,sizeof(int) * num_of_servers);
+	for(i=0,num_of_advertised=0;i<num_of_servers;i++){
+		if(is_advertised(i))
+			advertised[num_of_advertised++]=i;
+	}
+	if(num_of_advertised>MAX_VECTOR_ENTRIES){ // legacy updates and the buffers they are built in would overflow
+		printf("Topology file %s has %d servers to advertise, more than the %d an update can carry, split it into areas\n",topology_file,num_of_advertised,MAX_VECTOR_ENTRIES);
+		exit(0);
+	}
+	free(entries);
+	free(areas);
 
 	// Setup a num_of_servers * num_of_servers matrix for routing table
-	adj_matrix = (uint16_t**)malloc(num_of_servers *sizeof(uint16_t*));
+	adj_matrix = (metric_t**)malloc(num_of_servers *sizeof(metric_t*));
 
 	for(i=0;i<num_of_servers;i++){
-		adj_matrix[i] = (uint16_t**)malloc(num_of_servers *sizeof(uint16_t*));
+		adj_matrix[i] = (metric_t*)malloc(num_of_servers *sizeof(metric_t));
 
 	}
 
@@ -825,46 +3247,45 @@ void parse_topology_file(char * topology_file){
 			if(i==j)
 				adj_matrix[i][i]=0;
 			else
-				adj_matrix[i][j]=USHRT_MAX; // infinity
+				adj_matrix[i][j]=metric_infinity; // infinity
 
 		}
         
     }
-    // print routing table
-    //printf("-----Initial Routing Table-----\n");
-    //display_all_distance_vectors();
 
 	// update routing table based on topology file 
 
 	for(i=0;i<num_of_neighbors;i++){
 
-		fgets(buffer, 1024, topology_file_ptr);
-		from=atoi(strtok(buffer," "));
-		to=atoi(strtok(NULL," "));
-		cost=atoi(strtok(NULL," "));
+		from=server_index(link_from[i]);
+		to=server_index(link_to[i]);
+		cost=link_cost[i];
+		if(from<0 || to<0){
+			printf("Link %d-%d names a server missing from the topology file, ignored\n",link_from[i],link_to[i]);
+			continue;
+		}
+		if(cost>=metric_infinity){
+			printf("Cost %lu of link %d-%d is not below infinity %lu, link unusable\n",(unsigned long)cost,link_from[i],link_to[i],(unsigned long)metric_infinity);
+			cost=metric_infinity;
+		}
 
-		adj_matrix[from-1][to-1]=cost; 
-		adj_matrix[to-1][from-1]=cost;
+		adj_matrix[from][to]=cost; 
+		adj_matrix[to][from]=cost;
 
 
 		//save to my_neighbors
-		servers[to-1].is_neighbor=1;
-		servers[to-1].next_hop=my_id;
-		servers[to-1].cost=cost;
+		servers[to].is_neighbor=1;
+		servers[to].link_cost=cost;
+		set_next_hop(to,my_id);
+		servers[to].cost=cost;
 
 	}
+	free(link_from);
+	free(link_to);
+	free(link_cost);
 
-	servers[my_id-1].cost=0;
-	servers[my_id-1].next_hop=my_id;
-
-	// print routing table (updated)
-	//printf("-----Updated Routing Table-----\n");
-	//display_all_distance_vectors();
-
-
-
-	fclose(topology_file_ptr);
-
+	servers[my_index].cost=0;
+	set_next_hop(my_index,my_id);
 
 }
 
@@ -882,17 +3303,26 @@ void parse_topology_file(char * topology_file){
 *		Integer indicating success/failure of function
 *
 */
+#ifndef ROUTER_NO_MAIN
 int main(int argc, char** argv) {
 	int c;
 	int t_flag=0;
 	int i_flag=0;
 	char* topology_file;
 	char* update_interval;
+	char* capture_file_name=NULL;
+	char* event_file_name=NULL;
+	char* end;
 
 	/* parsing command line arguments */
-	static char usage[] = "usage: %s  -t <topology file name> -i <update interval>\n";
-
-	while ((c = getopt (argc, argv, "t:i:")) != -1){
+	static char usage[] = "usage: %s  -t <topology file name> -i <update interval> [-p <prefix/len>]... [-j <jitter %%>] [-b <max backoff>] [-w <hold down ms>] [-d <damping half life s>] [-H <hello interval ms>] [--id <server-ID>] [--bind <IP address>] [-c <capture file>] [-q] [-l] [-r <retransmit timeout ms>] [-m <infinity>] [-e <event trace file>] [-R <receive threads>]\n";
+	static struct option long_options[] = {
+		{"id", required_argument, NULL, 'I'},
+		{"bind", required_argument, NULL, 'B'},
+		{NULL, 0, NULL, 0}
+	};
+
+	while ((c = getopt_long (argc, argv, "t:i:p:j:b:w:d:H:c:qlr:m:e:R:", long_options, NULL)) != -1){
 		switch (c) {
 			case 't':
 				t_flag=1;
@@ -903,6 +3333,71 @@ int main(int argc, char** argv) {
 				i_flag=1;
 
 				update_interval=optarg;
+				if(strtol(update_interval,&end,10)<1 || *end!='\0' || strtol(update_interval,NULL,10)>INT_MAX/1000){
+					fprintf(stderr, "%s: update interval must be a whole number of seconds, at least 1\n", argv[0]);
+					exit(0);
+				}
+				break;
+			case 'p':
+				if(num_of_own_prefixes<MAX_OWN_PREFIXES)
+					own_prefixes[num_of_own_prefixes++]=optarg;
+				break;
+			case 'j':
+				jitter_percent=atoi(optarg);
+				if(jitter_percent<0)
+					jitter_percent=0;
+				if(jitter_percent>100)
+					jitter_percent=100;
+				break;
+			case 'b':
+				max_backoff=atoi(optarg);
+				if(max_backoff<1)
+					max_backoff=1;
+				break;
+			case 'w':
+				hold_down_ms=atoi(optarg);
+				break;
+			case 'd':
+				damp_half_life_ms=atof(optarg)*1000;
+				break;
+			case 'H':
+				hello_interval_ms=atoi(optarg);
+				if(hello_interval_ms>USHRT_MAX)
+					hello_interval_ms=USHRT_MAX;
+				break;
+			case 'I':
+				requested_id=atoi(optarg);
+				break;
+			case 'B':
+				bind_ip=optarg;
+				break;
+			case 'c':
+				capture_file_name=optarg;
+				break;
+			case 'e':
+				event_file_name=optarg;
+				break;
+			case 'R':
+				rx_shards=atoi(optarg);
+				if(rx_shards<1)
+					rx_shards=1;
+				break;
+			case 'q':
+				quiet=1;
+				break;
+			case 'l':
+				compact_updates=0;
+				unchanged_keepalives=0;
+				break;
+			case 'r':
+				reliable_rto_ms=atoi(optarg);
+				break;
+			case 'm':
+				if(strtoul(optarg,NULL,10)<1 || strtoul(optarg,NULL,10)>METRIC_MAX){
+					fprintf(stderr, "%s: infinity must be 1..%lu\n", argv[0], (unsigned long)METRIC_MAX);
+					exit(0);
+				}
+				metric_infinity=strtoul(optarg,NULL,10);
 				break;
 
 			case '?':
@@ -928,18 +3423,15 @@ int main(int argc, char** argv) {
 
 	/* end parsing command line arguments */
 
-	get_my_ip_address();
+	if(requested_id==0 && bind_ip==NULL)
+		read_local_ips();
 	
 	char msg[1024]; //read
 	int numBytes; // number of bytes read
 
-	int i,j,selected; //iterators
+	int i,selected; //iterators
 	int select_return;
 
-	//server info
-	int server_id;
-	//end server info
-
 	//my details
 	struct sockaddr_in my_ip_struct;
 	int optval = 1;  //for sockopt
@@ -947,13 +3439,26 @@ int main(int argc, char** argv) {
 	//end my details
 
 	//FD
-	fd_set read_fds, write_fds,read_fds_copy,write_fds_copy;
+	fd_set read_fds,read_fds_copy;
 	int fdMax;
 
 	struct timeval time_out;
-	time_out.tv_sec=atoi(update_interval);
+	long long now,wait_ms;
 
 	parse_topology_file(topology_file);
+	add_own_prefixes();
+	if(capture_file_name!=NULL && open_capture_file(capture_file_name)<0)
+		return -1;
+	if(event_file_name!=NULL && event_trace_open(event_file_name,my_id)<0)
+		return -1;
+
+	srand(time(NULL)^getpid()^(my_id<<16));
+	base_interval_ms=atoi(update_interval)*1000LL;
+	current_interval_ms=base_interval_ms;
+	now=now_ms();
+	next_tick_ms=now+base_interval_ms;
+	next_hello_ms=now;
+	next_periodic_ms=now+base_interval_ms*(100-rand()%(jitter_percent+1))/100; // desynchronize the first update
 
 	//create my socket
 
@@ -963,10 +3468,13 @@ int main(int argc, char** argv) {
     }
 	memset(&my_ip_struct, 0 , sizeof(my_ip_struct));
 	my_ip_struct.sin_family = AF_INET; 
-    my_ip_struct.sin_addr.s_addr = INADDR_ANY; 
+    my_ip_struct.sin_addr.s_addr = bind_ip!=NULL ? my_ip : INADDR_ANY; 
     my_ip_struct.sin_port = htons(my_port); 
 
     setsockopt(my_socket, SOL_SOCKET, SO_REUSEADDR, &optval, sizeof(int));
+    setsockopt(my_socket, SOL_SOCKET, SO_RXQ_OVFL, &optval, sizeof(int)); // report receive buffer drops
+	if(rx_shards>1)
+		setsockopt(my_socket, SOL_SOCKET, SO_REUSEPORT, &optval, sizeof(int)); // the shards bind the same port
 
     if (bind(my_socket, (struct sockaddr*)&my_ip_struct, sizeof(my_ip_struct)) < 0){ 
 		perror("bind"); 
@@ -974,59 +3482,75 @@ int main(int argc, char** argv) {
     }
 
     printf("Server IP-> %s Port-> %d \n",my_ip_raw,my_port);
+	if(rx_shards>1 && rx_shard_start(&my_ip_struct)<0)
+		return -1;
+
+	for(i=0;i<num_of_servers;i++){ // neighbors that kept my routes through a restart, or are simply up, send their vectors right away
+		if(servers[i].is_neighbor)
+			send_resync(i);
+	}
 
 
 	FD_ZERO (&read_fds); 
 	FD_SET (my_socket, &read_fds); 
 	FD_SET (0, &read_fds);
 	fdMax=my_socket;
+	if(rx_shards>1){
+		FD_SET (rx_wake_fd, &read_fds);
+		if(rx_wake_fd>fdMax)
+			fdMax=rx_wake_fd;
+	}
 
     while(1) {
 
     	read_fds_copy = read_fds;
+		wait_ms=next_timer_ms()-now_ms();
+		if(wait_ms<0)
+			wait_ms=0;
+		time_out.tv_sec=wait_ms/1000;
+		time_out.tv_usec=(wait_ms%1000)*1000;
     	select_return=select(fdMax+1, &read_fds_copy,NULL, NULL, &time_out);
 		if (select_return== -1) {
 			perror("select");
 			continue;
 		}
-		else if(select_return==0) { //timeout
-			printf("Timeout! Sending updates to neighbors\n");
-
-			for (i = 0; i < num_of_servers; i++){
-				if(servers[i].is_neighbor==1)
-					servers[i].num_of_skips++; 
+		now=now_ms();
+		if(select_return==0 || now>=next_timer_ms()) { //timeout, or timers overdue while busy receiving
+			if(now>=next_tick_ms){
+				next_tick_ms+=base_interval_ms;
+				report_interval_stats();
+
+				count_skips();
+				if(current_interval_ms>base_interval_ms && next_periodic_ms-now>=base_interval_ms/2) // backed off, the update is not about to go out
+					send_keepalives();
+				release_damped_links();
+				if(capture_file!=NULL)
+					fflush(capture_file);
+				event_trace_flush();
+			}
+			if(hello_interval_ms>0 && now>=next_hello_ms){
+				next_hello_ms=now+hello_interval_ms;
+				send_hellos();
+				check_hellos();
 			}
 
-			for (i = 0; i < num_of_servers; i++){ 
-
-				if(servers[i].is_neighbor){
-					if (servers[i].num_of_skips == 3) {
-
-						servers[i].is_alive = 0;
-						servers[i].cost=USHRT_MAX;
-						servers[i].is_neighbor=0;
-						servers[i].next_hop=-1;
-						adj_matrix[my_id-1][servers[i].server_id-1]= USHRT_MAX;
-						adj_matrix[servers[i].server_id-1][my_id-1]= USHRT_MAX; 
-						for(j=0;j<num_of_servers;j++){
-							if(servers[j].next_hop==servers[i].server_id){
-								servers[j].next_hop=-1;
-								servers[j].cost=USHRT_MAX;
-
-					
-							}
-						}
-						//display_routes();
-					}
-
-				} 
-			} 	
+			check_dead_neighbors();
 
-			send_update_pkt();
-		
-			time_out.tv_sec=atoi(update_interval); //reset timer value
+			if(now>=next_periodic_ms){
+				printf("Timeout! Sending updates to neighbors\n");
+				send_periodic_update();
+			}
+			if(triggered_pending && now>=triggered_due_ms){
+				printf("Sending triggered updates to neighbors\n");
+				send_triggered_update();
+			}
+			if(next_retransmit_ms>0 && now>=next_retransmit_ms)
+				retransmit_updates();
+			if(next_ack_ms>0 && now>=next_ack_ms)
+				send_due_acks();
 
-			continue;
+			if(select_return==0)
+				continue;
 		}
 
 
@@ -1044,7 +3568,7 @@ int main(int argc, char** argv) {
 								printf("UPDATE: %s\n",response_message);
 							break;
 							case 1: //step
-								send_update_pkt();
+								send_update_pkt(0);
 								printf("%s SUCCESS\n",msg);								
 							break;
 							case 2: //packets
@@ -1061,30 +3585,87 @@ int main(int argc, char** argv) {
 								disable(atoi(parsedCommand[1]));
 								printf("DISABLE: %s\n",response_message);
 							break;
+							case 9: //restart
+								announce_restart(parsedCommand[1]!=NULL ? atoi(parsedCommand[1]) : RESTART_WINDOW_S);
+								// then shut down like crash
 							case 5: //crash
+								if(rx_shards>1)
+									rx_shard_stop();
 								close(my_socket);
+								if(capture_file!=NULL)
+									fclose(capture_file);
+								event_trace_close();
 								printf("%s SUCCESS\n",msg);
 								return 1;
 							break;
+							case 6: //fib
+								display_fib();
+								printf("%s SUCCESS\n",msg);
+							break;
+							case 7: //lookup
+								{
+									struct in_addr addr;
+									if(inet_pton(AF_INET,parsedCommand[1],&addr)!=1){
+										printf("LOOKUP: Invalid IP address %s\n",parsedCommand[1]);
+										break;
+									}
+									int dest=fib_lookup_dest(&fib,ntohl(addr.s_addr));
+									printf("LOOKUP: %s next hop %d, equal cost next hops ",parsedCommand[1],fib_lookup(&fib,ntohl(addr.s_addr)));
+									if(dest<0)
+										print_next_hops(NULL,0);
+									else
+										print_next_hops(fib.next_hops[dest].hops,fib.next_hops[dest].count);
+									printf("\n");
+								}
+							break;
+							case 8: //whatif
+								whatif(atoi(parsedCommand[1]),atoi(parsedCommand[2]),parsedCommand[3]);
+								printf("WHATIF: %s\n",response_message);
+							break;
 						}
 
 					}
 
 
 				}
+				else if(selected==rx_wake_fd)
+					rx_shard_merge();
 				else if(selected==my_socket){ //receieved update packet from neighbors
-					char recv_buf[1000];
+					char recv_buf[MAX_PKT_SIZE];
+					int recv_len;
 
 					struct sockaddr_in src_ip_struct;
-					socklen_t src_ip_struct_len=sizeof(struct sockaddr);
 					memset(&src_ip_struct, 0, sizeof(struct sockaddr_in));
 
-
-					if(recvfrom(my_socket, &recv_buf, sizeof(recv_buf),0, (struct sockaddr*)&src_ip_struct, &src_ip_struct_len)<0){
+					// recvmsg instead of recvfrom to get the SO_RXQ_OVFL drop counter
+					char control[CMSG_SPACE(sizeof(uint32_t))];
+					struct iovec iov={recv_buf,sizeof(recv_buf)};
+					struct msghdr recv_msg;
+					struct cmsghdr *cmsg;
+					memset(&recv_msg,0,sizeof(recv_msg));
+					recv_msg.msg_name=&src_ip_struct;
+					recv_msg.msg_namelen=sizeof(src_ip_struct);
+					recv_msg.msg_iov=&iov;
+					recv_msg.msg_iovlen=1;
+					recv_msg.msg_control=control;
+					recv_msg.msg_controllen=sizeof(control);
+
+
+					if((recv_len=recvmsg(my_socket, &recv_msg, 0))<0){
 						perror("recv");
 					}
 					else {
-						deserialize_pkt(recv_buf);
+						for(cmsg=CMSG_FIRSTHDR(&recv_msg);cmsg!=NULL;cmsg=CMSG_NXTHDR(&recv_msg,cmsg)){
+							if(cmsg->cmsg_level==SOL_SOCKET && cmsg->cmsg_type==SO_RXQ_OVFL)
+								memcpy(&rx_dropped,CMSG_DATA(cmsg),sizeof(uint32_t));
+						}
+						interval_stats.pkts_processed++;
+						if(capture_file!=NULL)
+							capture_pkt(recv_buf,recv_len,&src_ip_struct);
+						if(rx_shards>1)
+							rx_shard_stage(recv_buf,recv_len); // merged with the other shards
+						else
+							deserialize_pkt(recv_buf,recv_len);
 						
 					}
 
@@ -1101,3 +3682,4 @@ int main(int argc, char** argv) {
 
 
 }
+#endif
@@ -0,0 +1,392 @@
+/*
+*
+* 	All pairs shortest paths for what-if analysis
+*
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "apsp.h"
+
+/* shared state of one apsp_solve() call */
+struct apsp_job{
+	struct apsp *apsp;
+	int num_of_blocks;
+	int num_of_threads;
+	pthread_barrier_t barrier;
+	pthread_mutex_t lock;
+	pthread_cond_t started; // num_of_threads is final once go is set
+	int go;
+};
+
+struct apsp_worker{
+	pthread_t thread;
+	struct apsp_job *job;
+	int id;
+};
+
+
+/*
+*
+*	Initializes a graph with no edges, every node at distance 0 from itself. Graphs of
+*	up to APSP_FULL_MAX nodes get the full matrix for apsp_solve(), larger ones only
+*	an edge list for apsp_solve_rows().
+*
+*	@return
+*		Integer indicating success/failure of function
+*
+*/
+int apsp_init(struct apsp *apsp,int n){
+	long i,cells;
+
+	memset(apsp,0,sizeof(struct apsp));
+	apsp->n=n;
+	if(n>APSP_FULL_MAX){
+		apsp->stride=n;
+		apsp->row_of=(int*)malloc(sizeof(int)*n);
+		if(apsp->row_of==NULL)
+			return -1;
+		for(i=0;i<n;i++)
+			apsp->row_of[i]=-1;
+		return 1;
+	}
+	apsp->stride=(n+APSP_BLOCK-1)/APSP_BLOCK*APSP_BLOCK;
+	cells=(long)apsp->stride*apsp->stride;
+	if(posix_memalign((void**)&apsp->dist,64,cells*sizeof(uint32_t))!=0){
+		apsp->dist=NULL;
+		return -1;
+	}
+	for(i=0;i<cells;i++)
+		apsp->dist[i]=APSP_INF;
+	for(i=0;i<apsp->stride;i++)
+		apsp->dist[i*apsp->stride+i]=0;
+	return 1;
+}
+
+/*
+*
+*	Frees a graph
+*
+*/
+void apsp_free(struct apsp *apsp){
+	free(apsp->dist);
+	free(apsp->row_of);
+	free(apsp->edges);
+	memset(apsp,0,sizeof(struct apsp));
+}
+
+/*
+*
+*	Appends an edge to a sparse graph, see apsp_set()
+*
+*/
+void apsp_add_edge(struct apsp *apsp,int from,int to,uint32_t cost){
+	if(apsp->num_of_edges==apsp->edge_capacity){
+		int capacity=apsp->edge_capacity ? apsp->edge_capacity*2 : apsp->n*4;
+		struct apsp_edge *grown=(struct apsp_edge*)realloc(apsp->edges,sizeof(struct apsp_edge)*capacity);
+		if(grown==NULL){
+			apsp->failed=1;
+			return;
+		}
+		apsp->edges=grown;
+		apsp->edge_capacity=capacity;
+	}
+	apsp->edges[apsp->num_of_edges].from=from;
+	apsp->edges[apsp->num_of_edges].to=to;
+	apsp->edges[apsp->num_of_edges++].cost=cost;
+}
+
+/*
+*
+*	Relaxes tile c through the pivot tiles: c[i][j] = min(c[i][j], a[i][k] + b[k][j]).
+*	k is the outer loop so the update stays correct when c is a or b (pivot row,
+*	column and tile), and the inner loop runs over contiguous memory.
+*
+*/
+static void relax_block(uint32_t *c,const uint32_t *a,const uint32_t *b,int stride){
+	int i,j,k;
+
+	for(k=0;k<APSP_BLOCK;k++){
+		const int32_t *b_row=(const int32_t*)b+(long)k*stride;
+		for(i=0;i<APSP_BLOCK;i++){
+			int32_t a_ik=a[(long)i*stride+k];
+			int32_t *c_row=(int32_t*)c+(long)i*stride;
+			for(j=0;j<APSP_BLOCK;j++){
+				int32_t through=a_ik+b_row[j];
+				c_row[j]=through<c_row[j] ? through : c_row[j];
+			}
+		}
+	}
+}
+
+/*
+*
+*	relax_block() for a tile that is neither pivot row nor pivot column. Nothing
+*	aliases, so each row of c is kept in a local buffer while k runs (signed
+*	compares vectorize on plain SSE2, APSP_INF sums still fit in int32_t).
+*
+*/
+static void relax_independent_block(uint32_t *c,const uint32_t *a,const uint32_t *b,int stride){
+	int32_t row[APSP_BLOCK];
+	int i,j,k;
+
+	for(i=0;i<APSP_BLOCK;i++){
+		int32_t *c_row=(int32_t*)c+(long)i*stride;
+		const int32_t *a_row=(const int32_t*)a+(long)i*stride;
+		memcpy(row,c_row,sizeof(row));
+		for(k=0;k<APSP_BLOCK;k++){
+			const int32_t *b_row=(const int32_t*)b+(long)k*stride;
+			int32_t a_ik=a_row[k];
+			for(j=0;j<APSP_BLOCK;j++){
+				int32_t through=a_ik+b_row[j];
+				row[j]=through<row[j] ? through : row[j];
+			}
+		}
+		memcpy(c_row,row,sizeof(row));
+	}
+}
+
+/*
+*
+*	Returns the first entry of tile bi, bj
+*
+*/
+static inline uint32_t *tile(struct apsp *apsp,int bi,int bj){
+	return apsp->dist+(long)bi*APSP_BLOCK*apsp->stride+(long)bj*APSP_BLOCK;
+}
+
+/*
+*
+*	Worker thread of apsp_solve(), relaxes its share of the tiles of every phase
+*
+*/
+static void *apsp_worker_main(void *arg){
+	struct apsp_worker *worker=(struct apsp_worker*)arg;
+	struct apsp_job *job=worker->job;
+	struct apsp *apsp=job->apsp;
+	int nb=job->num_of_blocks,kb,t,bi,bj;
+
+	pthread_mutex_lock(&job->lock);
+	while(!job->go)
+		pthread_cond_wait(&job->started,&job->lock);
+	pthread_mutex_unlock(&job->lock);
+
+	for(kb=0;kb<nb;kb++){
+		uint32_t *pivot=tile(apsp,kb,kb);
+
+		if(worker->id==0)
+			relax_block(pivot,pivot,pivot,apsp->stride);
+		if(job->num_of_threads>1)
+			pthread_barrier_wait(&job->barrier);
+
+		// pivot row and pivot column tiles
+		for(t=worker->id;t<2*nb;t+=job->num_of_threads){
+			if(t%nb==kb)
+				continue;
+			if(t<nb){
+				uint32_t *row=tile(apsp,kb,t);
+				relax_block(row,pivot,row,apsp->stride);
+			}
+			else{
+				uint32_t *column=tile(apsp,t-nb,kb);
+				relax_block(column,column,pivot,apsp->stride);
+			}
+		}
+		if(job->num_of_threads>1)
+			pthread_barrier_wait(&job->barrier);
+
+		// every other tile, through its pivot row and column tiles
+		for(t=worker->id;t<nb*nb;t+=job->num_of_threads){
+			bi=t/nb;
+			bj=t%nb;
+			if(bi==kb || bj==kb)
+				continue;
+			relax_independent_block(tile(apsp,bi,bj),tile(apsp,bi,kb),tile(apsp,kb,bj),apsp->stride);
+		}
+		if(job->num_of_threads>1)
+			pthread_barrier_wait(&job->barrier);
+	}
+	return NULL;
+}
+
+/*
+*
+*	Replaces the edge weights in apsp with shortest path distances
+*
+*	@param num_of_threads
+*		Worker threads, 0 picks one per online CPU up to APSP_MAX_THREADS
+*
+*	@return
+*		Number of threads used
+*
+*/
+int apsp_solve(struct apsp *apsp,int num_of_threads){
+	struct apsp_job job;
+	struct apsp_worker workers[APSP_MAX_THREADS];
+	int i;
+
+	job.apsp=apsp;
+	job.num_of_blocks=apsp->stride/APSP_BLOCK;
+	if(num_of_threads<=0)
+		num_of_threads=sysconf(_SC_NPROCESSORS_ONLN);
+	if(num_of_threads>APSP_MAX_THREADS)
+		num_of_threads=APSP_MAX_THREADS;
+	if(num_of_threads>job.num_of_blocks*job.num_of_blocks/4) // too few tiles to share
+		num_of_threads=1;
+	job.num_of_threads=num_of_threads;
+
+	job.go=0;
+	pthread_mutex_init(&job.lock,NULL);
+	pthread_cond_init(&job.started,NULL);
+
+	// workers wait for go, so the thread count can shrink if pthread_create() fails
+	for(i=0;i<num_of_threads;i++){
+		workers[i].job=&job;
+		workers[i].id=i;
+		if(i>0 && pthread_create(&workers[i].thread,NULL,apsp_worker_main,&workers[i])!=0)
+			break;
+	}
+	num_of_threads=i;
+	job.num_of_threads=num_of_threads;
+	if(num_of_threads>1)
+		pthread_barrier_init(&job.barrier,NULL,num_of_threads);
+
+	pthread_mutex_lock(&job.lock);
+	job.go=1;
+	pthread_cond_broadcast(&job.started);
+	pthread_mutex_unlock(&job.lock);
+
+	apsp_worker_main(&workers[0]);
+	for(i=1;i<num_of_threads;i++)
+		pthread_join(workers[i].thread,NULL);
+
+	if(num_of_threads>1)
+		pthread_barrier_destroy(&job.barrier);
+	pthread_cond_destroy(&job.started);
+	pthread_mutex_destroy(&job.lock);
+	return num_of_threads;
+}
+
+/* binary min heap of (distance, node) for apsp_solve_rows() */
+struct heap_entry{
+	uint32_t dist;
+	int node;
+};
+
+/*
+*
+*	Pushes a node onto the binary min heap of Dijkstra
+*
+*/
+static void heap_push(struct heap_entry *heap,int *size,uint32_t dist,int node){
+	int i=(*size)++;
+
+	while(i>0 && heap[(i-1)/2].dist>dist){
+		heap[i]=heap[(i-1)/2];
+		i=(i-1)/2;
+	}
+	heap[i].dist=dist;
+	heap[i].node=node;
+}
+
+/*
+*
+*	Pops the closest node off the binary min heap of Dijkstra
+*
+*/
+static struct heap_entry heap_pop(struct heap_entry *heap,int *size){
+	struct heap_entry top=heap[0],last=heap[--(*size)];
+	int i=0,child;
+
+	while((child=2*i+1)<*size){
+		if(child+1<*size && heap[child+1].dist<heap[child].dist)
+			child++;
+		if(heap[child].dist>=last.dist)
+			break;
+		heap[i]=heap[child];
+		i=child;
+	}
+	heap[i]=last;
+	return top;
+}
+
+/*
+*
+*	Solves the source rows of a sparse graph: Dijkstra from each source over an
+*	adjacency list sorted out of the edge list, so graphs with thousands of nodes
+*	take milliseconds and no n * n matrix. apsp_get() answers for these rows only.
+*
+*	@param sources
+*		count node indexes
+*
+*	@return
+*		Integer indicating success/failure of function
+*
+*/
+int apsp_solve_rows(struct apsp *apsp,const int *sources,int count){
+	int n=apsp->n,i,s,size,num_of_edges=apsp->num_of_edges;
+	int *first,*to;
+	uint32_t *cost;
+	struct heap_entry *heap;
+
+	if(!apsp_is_sparse(apsp) || apsp->failed)
+		return -1;
+	first=(int*)calloc(n+1,sizeof(int));
+	to=(int*)malloc(sizeof(int)*(num_of_edges+1));
+	cost=(uint32_t*)malloc(sizeof(uint32_t)*(num_of_edges+1));
+	heap=(struct heap_entry*)malloc(sizeof(struct heap_entry)*(num_of_edges+1)); // a push per relaxed edge, and the source
+	free(apsp->dist);
+	apsp->dist=(uint32_t*)malloc(sizeof(uint32_t)*n*count);
+	if(first==NULL || to==NULL || cost==NULL || heap==NULL || apsp->dist==NULL){
+		free(first);
+		free(to);
+		free(cost);
+		free(heap);
+		return -1;
+	}
+
+	// counting sort of the edges by their first node
+	for(i=0;i<num_of_edges;i++)
+		first[apsp->edges[i].from+1]++;
+	for(i=0;i<n;i++)
+		first[i+1]+=first[i];
+	for(i=0;i<num_of_edges;i++){
+		int slot=first[apsp->edges[i].from]++;
+		to[slot]=apsp->edges[i].to;
+		cost[slot]=apsp->edges[i].cost;
+	}
+	for(i=n;i>0;i--) // back to the start of each node's edges
+		first[i]=first[i-1];
+	first[0]=0;
+
+	for(s=0;s<count;s++){
+		uint32_t *d=apsp->dist+(long)s*n;
+		for(i=0;i<n;i++)
+			d[i]=APSP_INF;
+		d[sources[s]]=0;
+		apsp->row_of[sources[s]]=s;
+		size=0;
+		heap_push(heap,&size,0,sources[s]);
+		while(size>0){
+			struct heap_entry top=heap_pop(heap,&size);
+			if(top.dist>d[top.node]) // stale entry
+				continue;
+			for(i=first[top.node];i<first[top.node+1];i++){
+				uint32_t through=top.dist+cost[i];
+				if(through<d[to[i]]){
+					d[to[i]]=through;
+					heap_push(heap,&size,through,to[i]);
+				}
+			}
+		}
+	}
+
+	free(heap);
+	free(first);
+	free(to);
+	free(cost);
+	return 1;
+}
@@ -0,0 +1,85 @@
+/*
+*
+* 	All pairs shortest paths for what-if analysis
+*
+* 	Blocked Floyd-Warshall: the matrix is split in APSP_BLOCK x APSP_BLOCK tiles
+* 	that fit in L1/L2, and each round updates the pivot tile, then the pivot
+* 	row and column tiles, then every other tile. Tiles of the last two phases
+* 	are independent and are spread over threads. That is O(n^3), so graphs of
+* 	more than APSP_FULL_MAX nodes are kept as an edge list instead, and only the
+* 	rows of interest are solved with Dijkstra.
+*
+*/
+
+#ifndef APSP_H
+#define APSP_H
+
+#include <stdint.h>
+
+#define APSP_BLOCK 64
+#define APSP_INF 0x3fffffffu // two of them still fit in an int32_t
+#define APSP_MAX_THREADS 8
+#define APSP_FULL_MAX 512 // larger graphs only get the rows they need, see apsp_solve_rows()
+
+struct apsp_edge{
+	int from;
+	int to;
+	uint32_t cost;
+};
+
+struct apsp{
+	uint32_t *dist; // stride * stride, row major; sparse graphs: one row per solved node
+	int n; // number of nodes
+	int stride; // n rounded up to a multiple of APSP_BLOCK, n for sparse graphs
+	int *row_of; // sparse graphs only: row of dist holding each node's distances, -1 if not solved
+	struct apsp_edge *edges; // sparse graphs only: edges in the order they were set
+	int num_of_edges;
+	int edge_capacity;
+	int failed; // an edge could not be stored
+};
+
+int apsp_init(struct apsp *apsp,int n);
+void apsp_free(struct apsp *apsp);
+void apsp_add_edge(struct apsp *apsp,int from,int to,uint32_t cost);
+int apsp_solve(struct apsp *apsp,int num_of_threads);
+int apsp_solve_rows(struct apsp *apsp,const int *sources,int count);
+
+/*
+*
+*	Returns 1 if apsp_init() kept the graph as an edge list, to be solved with apsp_solve_rows()
+*
+*/
+static inline int apsp_is_sparse(const struct apsp *apsp){
+	return apsp->row_of!=NULL;
+}
+
+/*
+*
+*	Returns the distance from -> to, APSP_INF for rows a sparse graph did not solve
+*
+*/
+static inline uint32_t apsp_get(const struct apsp *apsp,int from,int to){
+	if(apsp_is_sparse(apsp)){
+		if(apsp->row_of[from]<0)
+			return APSP_INF;
+		from=apsp->row_of[from];
+	}
+	return apsp->dist[(long)from*apsp->stride+to];
+}
+
+/*
+*
+*	Sets the weight of the edge from -> to, costs of APSP_INF or more mean no edge.
+*	Sparse graphs keep every edge set, so each one has to be set at most once.
+*
+*/
+static inline void apsp_set(struct apsp *apsp,int from,int to,uint32_t cost){
+	if(apsp_is_sparse(apsp)){
+		if(cost<APSP_INF)
+			apsp_add_edge(apsp,from,to,cost);
+		return;
+	}
+	apsp->dist[(long)from*apsp->stride+to]=cost<APSP_INF ? cost : APSP_INF;
+}
+
+#endif
@@ -0,0 +1,171 @@
+/*
+*
+* 	Convergence event trace
+*
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "event_trace.h"
+
+/* ring of one thread, only that thread writes to it */
+struct event_ring{
+	struct event events[EVENT_RING_SIZE];
+	int count;
+	int tid;
+};
+
+int event_tracing=0; // set by event_trace_open()
+
+static FILE *event_file;
+static int event_pid;
+static pthread_mutex_t event_file_lock=PTHREAD_MUTEX_INITIALIZER;
+static uint32_t event_ids;
+static __thread struct event_ring *ring;
+
+static const char *event_names[]={"","recv","bellman_ford","triggered_send","periodic_send","neighbor_down"};
+static const char *event_a_names[]={"","sender","routes_changed","pkts_sent","pkts_sent","neighbor"};
+static const char *event_b_names[]={"","entries_changed",NULL,NULL,NULL,NULL};
+
+/*
+*
+*	Starts tracing into file_name, which gets a Chrome trace event JSON array
+*
+*	@param pid
+*		Process ID shown in the viewer, the server ID
+*
+*	@return
+*		Integer indicating success/failure of function
+*
+*/
+int event_trace_open(const char *file_name,int pid){
+	event_file=fopen(file_name,"w");
+	if(event_file==NULL){
+		perror("event trace file");
+		return -1;
+	}
+	event_pid=pid;
+	fprintf(event_file,"[\n");
+	event_tracing=1;
+	return 1;
+}
+
+/*
+*
+*	Returns a monotonic timestamp in nanoseconds, the clock of every event
+*
+*/
+int64_t event_clock_ns(){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC,&ts);
+	return (int64_t)ts.tv_sec*1000000000+ts.tv_nsec;
+}
+
+/*
+*
+*	Returns a new event id. Ids are shared by all threads so flows can cross them
+*
+*/
+uint32_t event_next_id(){
+	return __sync_add_and_fetch(&event_ids,1);
+}
+
+/*
+*
+*	Writes one end of a flow arrow
+*
+*/
+static void write_flow(char ph,uint32_t id,double ts,int tid){
+	fprintf(event_file,"{\"name\":\"cause\",\"cat\":\"dv\",\"ph\":\"%c\",%s\"id\":%u,\"ts\":%.3f,\"pid\":%d,\"tid\":%d},\n",
+		ph,ph=='f' ? "\"bp\":\"e\"," : "",id,ts,event_pid,tid);
+}
+
+/*
+*
+*	Writes the calling thread's buffered events to the trace file and empties its ring
+*
+*/
+void event_trace_flush(){
+	struct event *event;
+	double start,end;
+	int i;
+
+	if(!event_tracing || ring==NULL || ring->count==0)
+		return;
+
+	pthread_mutex_lock(&event_file_lock);
+	for(i=0;i<ring->count;i++){
+		event=&ring->events[i];
+		start=event->start_ns/1e3;
+		end=event->end_ns/1e3;
+		if(event->type==EVENT_NEIGHBOR_DOWN)
+			fprintf(event_file,"{\"name\":\"%s\",\"cat\":\"dv\",\"ph\":\"i\",\"s\":\"p\",\"ts\":%.3f,\"pid\":%d,\"tid\":%d,\"args\":{\"%s\":%u}},\n",
+				event_names[event->type],start,event_pid,ring->tid,event_a_names[event->type],event->a);
+		else{
+			fprintf(event_file,"{\"name\":\"%s\",\"cat\":\"dv\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":%d,\"tid\":%d,\"args\":{\"%s\":%u,",
+				event_names[event->type],start,end-start,event_pid,ring->tid,event_a_names[event->type],event->a);
+			if(event_b_names[event->type]!=NULL)
+				fprintf(event_file,"\"%s\":%u,",event_b_names[event->type],event->b);
+			fprintf(event_file,"\"cause\":%u,\"id\":%u}},\n",event->flow_in,event->flow_out);
+		}
+		if(event->flow_in!=0)
+			write_flow('f',event->flow_in,start,ring->tid);
+		if(event->flow_out!=0)
+			write_flow('s',event->flow_out,event->type==EVENT_NEIGHBOR_DOWN ? start : end,ring->tid);
+	}
+	fflush(event_file);
+	pthread_mutex_unlock(&event_file_lock);
+	ring->count=0;
+}
+
+/*
+*
+*	Flushes the calling thread and ends the JSON array. Rings of other threads
+*	must have been flushed by them.
+*
+*/
+void event_trace_close(){
+	if(!event_tracing)
+		return;
+	event_trace_flush();
+	fprintf(event_file,"{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"args\":{\"name\":\"server %d\"}}\n]\n",event_pid,event_pid);
+	fclose(event_file);
+	event_tracing=0;
+}
+
+/*
+*
+*	Buffers an event in the calling thread's ring, writing the ring out when it is full
+*
+*	@param start_ns
+*		From event_clock_ns(), the event ends now
+*
+*/
+void event_record(uint16_t type,int64_t start_ns,uint32_t a,uint32_t b,uint32_t flow_in,uint32_t flow_out){
+	struct event *event;
+
+	if(!event_tracing)
+		return;
+	if(ring==NULL){
+		ring=(struct event_ring*)calloc(1,sizeof(struct event_ring));
+		if(ring==NULL)
+			return;
+		ring->tid=syscall(SYS_gettid);
+	}
+	if(ring->count==EVENT_RING_SIZE)
+		event_trace_flush();
+
+	event=&ring->events[ring->count++];
+	event->type=type;
+	event->start_ns=start_ns;
+	event->end_ns=event_clock_ns();
+	event->a=a;
+	event->b=b;
+	event->flow_in=flow_in;
+	event->flow_out=flow_out;
+}
@@ -0,0 +1,47 @@
+/*
+*
+* 	Convergence event trace
+*
+* 	Events are recorded as fixed size binary records in a ring buffer per
+* 	thread and written out as Chrome trace event JSON, loadable in Perfetto
+* 	or chrome://tracing, when a ring fills up or on event_trace_flush().
+* 	Events carry flow ids, so a recompute links back to the packet or
+* 	neighbor failure that caused it and a triggered send to that recompute.
+* 	When tracing is off every hook is a test of event_tracing.
+*
+*/
+
+#ifndef EVENT_TRACE_H
+#define EVENT_TRACE_H
+
+#include <stdint.h>
+
+#define EVENT_RING_SIZE 4096 // events buffered per thread before they are written
+
+#define EVENT_RECV 1 // a = sender ID, b = distance vector entries changed
+#define EVENT_RECOMPUTE 2 // bellman_ford(), a = routes changed
+#define EVENT_TRIGGERED_SEND 3 // a = packets sent
+#define EVENT_PERIODIC_SEND 4 // a = packets sent
+#define EVENT_NEIGHBOR_DOWN 5 // instant, a = neighbor ID
+
+/* one traced event, binary until it is flushed */
+struct event{
+	int64_t start_ns; // CLOCK_MONOTONIC
+	int64_t end_ns;
+	uint32_t a;
+	uint32_t b;
+	uint32_t flow_in; // id of the event that caused this one, 0 if none
+	uint32_t flow_out; // id later events refer to, 0 if none
+	uint16_t type;
+};
+
+extern int event_tracing;
+
+int event_trace_open(const char *file_name,int pid);
+void event_trace_flush();
+void event_trace_close();
+uint32_t event_next_id();
+int64_t event_clock_ns();
+void event_record(uint16_t type,int64_t start_ns,uint32_t a,uint32_t b,uint32_t flow_in,uint32_t flow_out);
+
+#endif
@@ -0,0 +1,263 @@
+/*
+*
+* 	Longest prefix match forwarding table
+*
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <arpa/inet.h>
+
+#include "fib.h"
+
+
+/*
+*
+*	Initializes an empty forwarding table
+*
+*	@param num_of_dests
+*		Number of destinations (servers) prefixes can point to
+*
+*	@return
+*		Integer indicating success/failure of function
+*
+*/
+int fib_init(struct fib *fib,int num_of_dests){
+	memset(fib,0,sizeof(struct fib));
+	fib->l1=(uint32_t*)calloc(FIB_L1_SIZE,sizeof(uint32_t));
+	fib->next_hops=(struct fib_next_hops*)calloc(num_of_dests,sizeof(struct fib_next_hops));
+	if(fib->l1==NULL || fib->next_hops==NULL)
+		return -1;
+
+	fib->num_of_dests=num_of_dests;
+	return 1;
+}
+
+/*
+*
+*	Frees a forwarding table, leaving it empty
+*
+*/
+void fib_free(struct fib *fib){
+	free(fib->l1);
+	free(fib->chunks);
+	free(fib->prefixes);
+	free(fib->next_hops);
+	memset(fib,0,sizeof(struct fib));
+}
+
+/*
+*
+*	Adds a prefix to the prefix list. Takes effect on the next fib_rebuild()
+*
+*	@return
+*		Integer indicating success/failure of function
+*
+*/
+int fib_add_prefix(struct fib *fib,uint32_t prefix,int len,int dest){
+	if(len<0 || len>32 || dest<0 || dest>=fib->num_of_dests)
+		return -1;
+
+	if(fib->num_of_prefixes==fib->prefix_capacity){
+		int capacity=fib->prefix_capacity ? fib->prefix_capacity*2 : 16;
+		struct fib_prefix *grown=realloc(fib->prefixes,sizeof(struct fib_prefix)*capacity);
+		if(grown==NULL)
+			return -1;
+		fib->prefixes=grown;
+		fib->prefix_capacity=capacity;
+	}
+
+	if(len<32)
+		prefix&=~(0xffffffffu>>len);
+	fib->prefixes[fib->num_of_prefixes].prefix=prefix;
+	fib->prefixes[fib->num_of_prefixes].len=len;
+	fib->prefixes[fib->num_of_prefixes].dest=dest;
+	fib->num_of_prefixes++;
+	fib->dirty=1;
+	return 1;
+}
+
+/*
+*
+*	Replaces the prefixes owned by dest. Marks the table dirty only if the set differs.
+*
+*	@return
+*		1 if the prefix set changed, 0 if not, -1 on error
+*
+*/
+int fib_replace_dest_prefixes(struct fib *fib,int dest,struct fib_prefix *prefixes,int count){
+	int i,j,found,owned=0;
+
+	for(i=0;i<fib->num_of_prefixes;i++){
+		if(fib->prefixes[i].dest!=dest)
+			continue;
+		owned++;
+		found=0;
+		for(j=0;j<count;j++){
+			if(prefixes[j].prefix==fib->prefixes[i].prefix && prefixes[j].len==fib->prefixes[i].len){
+				found=1;
+				break;
+			}
+		}
+		if(!found)
+			break;
+	}
+	if(i==fib->num_of_prefixes && owned==count)
+		return 0;
+
+	j=0;
+	for(i=0;i<fib->num_of_prefixes;i++){ // drop the old set
+		if(fib->prefixes[i].dest!=dest)
+			fib->prefixes[j++]=fib->prefixes[i];
+	}
+	fib->num_of_prefixes=j;
+
+	for(i=0;i<count;i++){
+		if(fib_add_prefix(fib,prefixes[i].prefix,prefixes[i].len,dest)<0)
+			return -1;
+	}
+	fib->dirty=1;
+	return 1;
+}
+
+/*
+*
+*	Qsort() comparator, shorter prefixes first
+*
+*/
+static int compare_prefix_len(const void *a,const void *b){
+	return ((const struct fib_prefix*)a)->len-((const struct fib_prefix*)b)->len;
+}
+
+/*
+*
+*	Returns the index of a new chunk with every slot set to leaf
+*
+*/
+static int new_chunk(struct fib *fib,uint32_t leaf){
+	int i;
+
+	if(fib->num_of_chunks==fib->chunk_capacity){
+		int capacity=fib->chunk_capacity ? fib->chunk_capacity*2 : 64;
+		uint32_t *grown=realloc(fib->chunks,sizeof(uint32_t)*FIB_CHUNK_SIZE*capacity);
+		if(grown==NULL)
+			return -1;
+		fib->chunks=grown;
+		fib->chunk_capacity=capacity;
+	}
+	for(i=0;i<FIB_CHUNK_SIZE;i++)
+		fib->chunks[fib->num_of_chunks*FIB_CHUNK_SIZE+i]=leaf;
+	return fib->num_of_chunks++;
+}
+
+/*
+*
+*	Returns the chunk below *slot, splitting a leaf into a chunk if needed
+*
+*/
+static int descend(struct fib *fib,uint32_t *slot_base,int slot_index){
+	uint32_t slot=slot_base[slot_index];
+	int chunk;
+
+	if(slot&FIB_CHUNK_FLAG)
+		return slot&~FIB_CHUNK_FLAG;
+
+	chunk=new_chunk(fib,slot);
+	return chunk;
+}
+
+/*
+*
+*	Rebuilds the trie from the prefix list. Shorter prefixes are written first
+*	so that longer prefixes overwrite them.
+*
+*	@return
+*		Integer indicating success/failure of function
+*
+*/
+int fib_rebuild(struct fib *fib){
+	int i,chunk;
+	uint32_t k,first,count,leaf,prefix;
+	struct fib_prefix *p;
+
+	if(fib->num_of_prefixes>0) // prefixes is NULL until the first fib_add()
+		qsort(fib->prefixes,fib->num_of_prefixes,sizeof(struct fib_prefix),compare_prefix_len);
+	memset(fib->l1,0,sizeof(uint32_t)*FIB_L1_SIZE);
+	fib->num_of_chunks=0;
+
+	for(i=0;i<fib->num_of_prefixes;i++){
+		p=&fib->prefixes[i];
+		prefix=p->prefix;
+		leaf=p->dest+1;
+
+		if(p->len<=16){
+			first=prefix>>16;
+			count=1u<<(16-p->len);
+			for(k=0;k<count;k++)
+				fib->l1[first+k]=leaf;
+			continue;
+		}
+
+		// chunks may move on realloc, so always index through fib->chunks
+		chunk=descend(fib,fib->l1,prefix>>16);
+		if(chunk<0)
+			return -1;
+		fib->l1[prefix>>16]=FIB_CHUNK_FLAG|chunk;
+
+		if(p->len<=24){
+			first=(prefix>>8)&0xff;
+			count=1u<<(24-p->len);
+			for(k=0;k<count;k++)
+				fib->chunks[chunk*FIB_CHUNK_SIZE+first+k]=leaf;
+			continue;
+		}
+
+		{
+			int l2_index=chunk*FIB_CHUNK_SIZE+((prefix>>8)&0xff);
+			int l3=descend(fib,fib->chunks,l2_index);
+			if(l3<0)
+				return -1;
+			fib->chunks[l2_index]=FIB_CHUNK_FLAG|l3;
+
+			first=prefix&0xff;
+			count=1u<<(32-p->len);
+			for(k=0;k<count;k++)
+				fib->chunks[l3*FIB_CHUNK_SIZE+first+k]=leaf;
+		}
+	}
+
+	fib->dirty=0;
+	return 1;
+}
+
+/*
+*
+*	Parses "a.b.c.d/len"
+*
+*	@return
+*		Integer indicating success/failure of function
+*
+*/
+int fib_parse_prefix(const char *text,uint32_t *prefix,int *len){
+	char address[INET_ADDRSTRLEN];
+	const char *slash=strchr(text,'/');
+	struct in_addr parsed;
+	size_t address_len;
+
+	if(slash==NULL)
+		return -1;
+	address_len=slash-text;
+	if(address_len>=sizeof(address))
+		return -1;
+	memcpy(address,text,address_len);
+	address[address_len]='\0';
+
+	if(inet_pton(AF_INET,address,&parsed)!=1)
+		return -1;
+	*len=atoi(slash+1);
+	if(*len<0 || *len>32)
+		return -1;
+	*prefix=ntohl(parsed.s_addr);
+	return 1;
+}
@@ -0,0 +1,162 @@
+/*
+*
+* 	Longest prefix match forwarding table
+*
+* 	Multibit trie with strides 16-8-8 (DIR-24-8 style, smaller first stage).
+* 	Leaves store a destination index, not a next hop, so a route change
+* 	only rewrites one slot of the next hop table instead of the trie.
+*
+*/
+
+#ifndef FIB_H
+#define FIB_H
+
+#include <stdint.h>
+
+#define FIB_L1_BITS 16
+#define FIB_L1_SIZE (1<<FIB_L1_BITS)
+#define FIB_CHUNK_SIZE 256
+
+#define FIB_CHUNK_FLAG 0x80000000u // slot points to a 256 entry chunk
+#define FIB_NO_ROUTE 0 // leaf value 0 means no covering prefix
+#define FIB_MAX_PATHS 4 // equal cost next hops kept per destination
+
+/* one advertised prefix */
+struct fib_prefix{
+	uint32_t prefix; // host order
+	uint8_t len;
+	uint16_t dest; // destination index the prefix belongs to
+};
+
+/* equal cost next hop set of one destination */
+struct fib_next_hops{
+	uint16_t count; // 0 if unreachable
+	uint16_t hops[FIB_MAX_PATHS]; // next hop server IDs
+};
+
+struct fib{
+	uint32_t *l1; // FIB_L1_SIZE slots
+	uint32_t *chunks; // num_of_chunks * FIB_CHUNK_SIZE slots
+	int num_of_chunks;
+	int chunk_capacity;
+
+	struct fib_prefix *prefixes;
+	int num_of_prefixes;
+	int prefix_capacity;
+	int dirty; // prefix set changed since last rebuild
+
+	struct fib_next_hops *next_hops; // per destination index
+	int num_of_dests;
+};
+
+int fib_init(struct fib *fib,int num_of_dests);
+void fib_free(struct fib *fib);
+int fib_add_prefix(struct fib *fib,uint32_t prefix,int len,int dest);
+int fib_replace_dest_prefixes(struct fib *fib,int dest,struct fib_prefix *prefixes,int count);
+int fib_rebuild(struct fib *fib);
+int fib_parse_prefix(const char *text,uint32_t *prefix,int *len);
+
+/*
+*
+*	Updates the next hops of a destination. O(1), the trie is untouched.
+*
+*	@param hops
+*		count next hop server IDs, count 0 makes dest unreachable
+*
+*/
+static inline void fib_set_next_hops(struct fib *fib,int dest,const uint16_t *hops,int count){
+	int i;
+
+	if(count>FIB_MAX_PATHS)
+		count=FIB_MAX_PATHS;
+	for(i=0;i<count;i++)
+		fib->next_hops[dest].hops[i]=hops[i];
+	fib->next_hops[dest].count=count;
+}
+
+/*
+*
+*	Sets a single next hop for a destination, -1 makes it unreachable
+*
+*/
+static inline void fib_set_next_hop(struct fib *fib,int dest,int next_hop){
+	uint16_t hop=next_hop;
+
+	fib_set_next_hops(fib,dest,&hop,next_hop<0 ? 0 : 1);
+}
+
+/*
+*
+*	Hashes a flow 5-tuple so all packets of a flow take the same path
+*
+*/
+static inline uint32_t fib_flow_hash(uint32_t src,uint32_t dst,uint16_t src_port,uint16_t dst_port,uint8_t protocol){
+	uint64_t h=((uint64_t)src<<32|dst)*0x9e3779b97f4a7c15ull;
+
+	h^=((uint64_t)src_port<<24|(uint64_t)dst_port<<8|protocol)*0xc2b2ae3d27d4eb4full;
+	h^=h>>29;
+	return (uint32_t)(h>>32);
+}
+
+/*
+*
+*	Finds the destination index of the longest prefix covering addr
+*
+*	@param addr
+*		IPv4 address in host order
+*
+*	@return
+*		Destination index or -1 if no prefix covers addr
+*
+*/
+static inline int fib_lookup_dest(const struct fib *fib,uint32_t addr){
+	uint32_t slot=fib->l1[addr>>16];
+
+	if(slot&FIB_CHUNK_FLAG){
+		slot=fib->chunks[(slot&~FIB_CHUNK_FLAG)*FIB_CHUNK_SIZE+((addr>>8)&0xff)];
+		if(slot&FIB_CHUNK_FLAG)
+			slot=fib->chunks[(slot&~FIB_CHUNK_FLAG)*FIB_CHUNK_SIZE+(addr&0xff)];
+	}
+	return (int)slot-1;
+}
+
+/*
+*
+*	Finds the next hop server ID for addr
+*
+*	@return
+*		Next hop server ID or -1 if there is no usable route
+*
+*/
+static inline int fib_lookup(const struct fib *fib,uint32_t addr){
+	int dest=fib_lookup_dest(fib,addr);
+
+	if(dest<0 || fib->next_hops[dest].count==0)
+		return -1;
+	return fib->next_hops[dest].hops[0];
+}
+
+/*
+*
+*	Finds the next hop for a flow, spreading flows over the equal cost next hops
+*
+*	@param flow_hash
+*		Value from fib_flow_hash()
+*
+*	@return
+*		Next hop server ID or -1 if there is no usable route
+*
+*/
+static inline int fib_lookup_flow(const struct fib *fib,uint32_t addr,uint32_t flow_hash){
+	int dest=fib_lookup_dest(fib,addr);
+	const struct fib_next_hops *set;
+
+	if(dest<0)
+		return -1;
+	set=&fib->next_hops[dest];
+	if(set->count==0)
+		return -1;
+	return set->hops[((uint64_t)flow_hash*set->count)>>32]; // multiply-shift instead of modulo
+}
+
+#endif
@@ -0,0 +1,119 @@
+/*
+*
+* 	Lookup benchmark for the longest prefix match forwarding table
+*
+* 	usage: ./fib_bench [num of prefixes] [num of lookups]
+*
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "fib.h"
+
+#define NUM_OF_DESTS 1024
+
+
+/*
+*
+*	Returns a prefix length following a rough Internet table distribution (mostly /24)
+*
+*/
+static int random_prefix_len(){
+	int r = rand() % 100;
+
+	if(r < 55)
+		return 24;
+	if(r < 75)
+		return 22 + rand() % 2;
+	if(r < 90)
+		return 16 + rand() % 6;
+	if(r < 97)
+		return 8 + rand() % 8;
+	return 25 + rand() % 8;
+}
+
+static uint32_t random_addr(){
+	return ((uint32_t)rand() << 16) ^ (uint32_t)rand();
+}
+
+static double elapsed(struct timespec *start, struct timespec *end){
+	return (end->tv_sec - start->tv_sec) + (end->tv_nsec - start->tv_nsec) / 1e9;
+}
+
+int main(int argc, char** argv){
+	int num_of_prefixes = argc > 1 ? atoi(argv[1]) : 100000;
+	long num_of_lookups = argc > 2 ? atol(argv[2]) : 50000000;
+	int num_of_addrs = 1 << 20;
+	uint32_t *addrs;
+	struct fib fib;
+	struct timespec start, end;
+	long i, hits = 0;
+	unsigned long sum = 0;
+	double seconds;
+
+	srand(42);
+	fib_init(&fib, NUM_OF_DESTS);
+	for(i = 0; i < NUM_OF_DESTS; i++){
+		uint16_t hops[FIB_MAX_PATHS] = {i % 16 + 1, i % 16 + 2, i % 16 + 3, i % 16 + 4};
+		fib_set_next_hops(&fib, i, hops, i % FIB_MAX_PATHS + 1);
+	}
+
+	for(i = 0; i < num_of_prefixes; i++)
+		fib_add_prefix(&fib, random_addr(), random_prefix_len(), rand() % NUM_OF_DESTS);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	fib_rebuild(&fib);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	printf("Rebuild: %d prefixes, %d chunks, %.2f ms\n", num_of_prefixes, fib.num_of_chunks, elapsed(&start, &end) * 1e3);
+
+	// half the addresses fall inside an advertised prefix, half are random
+	addrs = (uint32_t*)malloc(sizeof(uint32_t) * num_of_addrs);
+	for(i = 0; i < num_of_addrs; i++){
+		if(i % 2 == 0){
+			struct fib_prefix *p = &fib.prefixes[rand() % fib.num_of_prefixes];
+			uint32_t host = p->len == 32 ? 0 : random_addr() & (0xffffffffu >> p->len);
+			addrs[i] = p->prefix | host;
+		}
+		else
+			addrs[i] = random_addr();
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for(i = 0; i < num_of_lookups; i++){
+		int hop = fib_lookup(&fib, addrs[i & (num_of_addrs - 1)]);
+		if(hop >= 0){
+			hits++;
+			sum += hop;
+		}
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	seconds = elapsed(&start, &end);
+
+	printf("Lookup: %ld lookups, %ld hits, %.2f s, %.1f Mlookups/s (checksum %lu)\n",
+		num_of_lookups, hits, seconds, num_of_lookups / seconds / 1e6, sum);
+
+	// same addresses through the ECMP path, hashing a synthetic 5-tuple per packet
+	hits = 0;
+	sum = 0;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for(i = 0; i < num_of_lookups; i++){
+		uint32_t dst = addrs[i & (num_of_addrs - 1)];
+		uint32_t hash = fib_flow_hash(0x0a000001, dst, (uint16_t)i, 80, 6);
+		int hop = fib_lookup_flow(&fib, dst, hash);
+		if(hop >= 0){
+			hits++;
+			sum += hop;
+		}
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	seconds = elapsed(&start, &end);
+
+	printf("Flow lookup: %ld lookups, %ld hits, %.2f s, %.1f Mlookups/s (checksum %lu)\n",
+		num_of_lookups, hits, seconds, num_of_lookups / seconds / 1e6, sum);
+
+	free(addrs);
+	fib_free(&fib);
+	return 0;
+}
@@ -0,0 +1,262 @@
+/*
+*
+* 	Update packet load generator. Impersonates the neighbors of a server from its
+* 	topology file and floods it with valid distance vectors from several threads.
+*
+* 	usage: ./loadgen -t <topology file name> --id <target server-ID> [-r <pkts/s>] [-T <threads>]
+* 	                 [-d <seconds>] [-n <entries per vector>] [-a]
+*
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+
+#include "router.h"
+
+#define VARIANTS_PER_SENDER 8 // vectors with different costs per impersonated server
+#define PACING_BATCH 64
+
+/* a prebuilt update packet */
+struct load_pkt{
+	char *data;
+	int len;
+};
+
+/* one sender thread */
+struct sender{
+	pthread_t thread;
+	int index;
+	double rate; // pkts/s for this thread, 0 for unlimited
+	unsigned long pkts_sent;
+	unsigned long bytes_sent;
+	unsigned long send_errors;
+};
+
+struct load_pkt *pkts;
+int num_of_pkts;
+struct sockaddr_in target;
+volatile int running=1;
+double duration_s=5;
+
+static double now_s(){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+*
+*	Returns the kernel drop counter of the UDP socket bound to port, -1 if not found
+*
+*/
+static long udp_drops(int port){
+	FILE *proc = fopen("/proc/net/udp", "r");
+	char line[512];
+	unsigned int local_port;
+	long drops = -1, value;
+	char *last;
+
+	if(proc == NULL)
+		return -1;
+	fgets(line, sizeof(line), proc); // header
+	while(fgets(line, sizeof(line), proc)){
+		if(sscanf(line, "%*d: %*x:%x", &local_port) != 1 || (int)local_port != port)
+			continue;
+		for(last = line + strlen(line); last > line && (last[-1] == ' ' || last[-1] == '\n'); last--)
+			*(last - 1) = '\0';
+		last = strrchr(line, ' ');
+		if(last != NULL && sscanf(last, "%ld", &value) == 1)
+			drops = drops < 0 ? value : drops + value;
+	}
+	fclose(proc);
+	return drops;
+}
+
+/*
+*
+*	Builds VARIANTS_PER_SENDER update packets for server index k with prepare_update_pkt()
+*	and serialize_packet(), posing as k
+*
+*/
+static void build_pkts(int k, int entries){
+	struct routing_update_pkt *packet;
+	char buf[MAX_PKT_SIZE];
+	int v, j, saved_id = my_id, saved_index = my_index, saved_port = my_port, saved_count = num_of_servers;
+	uint32_t saved_ip = my_ip;
+
+	my_id = servers[k].server_id;
+	my_index = k;
+	my_ip = servers[k].server_ip;
+	my_port = servers[k].server_port;
+	num_of_servers = entries;
+
+	packet = (struct routing_update_pkt*)malloc(sizeof(struct routing_update_pkt));
+	packet->updates = (struct distance_vector*)malloc(sizeof(struct distance_vector) * entries);
+
+	for(v = 0; v < VARIANTS_PER_SENDER; v++){
+		for(j = 0; j < entries; j++)
+			adj_matrix[k][j] = (j == k) ? 0 : 1 + rand() % 50;
+		if(servers[saved_index].link_cost != metric_infinity)
+			adj_matrix[k][saved_index] = servers[saved_index].link_cost;
+
+		prepare_update_pkt(packet);
+		pkts[num_of_pkts].len = serialize_packet(packet, buf);
+		pkts[num_of_pkts].data = (char*)malloc(pkts[num_of_pkts].len);
+		memcpy(pkts[num_of_pkts].data, buf, pkts[num_of_pkts].len);
+		num_of_pkts++;
+	}
+
+	free(packet->updates);
+	free(packet);
+	my_id = saved_id;
+	my_index = saved_index;
+	my_ip = saved_ip;
+	my_port = saved_port;
+	num_of_servers = saved_count;
+}
+
+static void *sender_main(void *arg){
+	struct sender *sender = (struct sender*)arg;
+	int sock = socket(AF_INET, SOCK_DGRAM, 0);
+	int next = sender->index;
+	double start = now_s(), due;
+	int i;
+
+	if(sock < 0 || connect(sock, (struct sockaddr*)&target, sizeof(target)) < 0){
+		perror("sender socket");
+		return NULL;
+	}
+
+	while(running){
+		for(i = 0; i < PACING_BATCH; i++){
+			if(send(sock, pkts[next].data, pkts[next].len, 0) < 0)
+				sender->send_errors++;
+			else{
+				sender->pkts_sent++;
+				sender->bytes_sent += pkts[next].len;
+			}
+			next = (next + 1) % num_of_pkts;
+		}
+		if(sender->rate > 0){
+			due = start + sender->pkts_sent / sender->rate;
+			while(running && now_s() < due){
+				struct timespec ts = {0, 50000};
+				nanosleep(&ts, NULL);
+			}
+		}
+	}
+
+	close(sock);
+	return NULL;
+}
+
+int main(int argc, char** argv){
+	int c, i, entries = 0, all = 0, num_of_threads = 2, target_index;
+	double rate = 0, start, elapsed;
+	char *topology_file = NULL;
+	struct sender *senders;
+	unsigned long pkts_sent = 0, bytes_sent = 0, send_errors = 0;
+	long drops_before, drops_after;
+	static char usage[] = "usage: %s -t <topology file name> --id <target server-ID> [-r <pkts/s>] [-T <threads>] [-d <seconds>] [-n <entries per vector>] [-a]\n";
+	static struct option long_options[] = {
+		{"id", required_argument, NULL, 'I'},
+		{NULL, 0, NULL, 0}
+	};
+
+	while((c = getopt_long(argc, argv, "t:r:T:d:n:a", long_options, NULL)) != -1){
+		switch(c){
+			case 't':
+				topology_file = optarg;
+				break;
+			case 'r':
+				rate = atof(optarg);
+				break;
+			case 'T':
+				num_of_threads = atoi(optarg);
+				break;
+			case 'd':
+				duration_s = atof(optarg);
+				break;
+			case 'n':
+				entries = atoi(optarg);
+				break;
+			case 'a':
+				all = 1;
+				break;
+			case 'I':
+				requested_id = atoi(optarg);
+				break;
+			default:
+				fprintf(stderr, usage, argv[0]);
+				exit(0);
+		}
+	}
+	if(topology_file == NULL || requested_id == 0 || num_of_threads < 1){
+		fprintf(stderr, usage, argv[0]);
+		exit(0);
+	}
+
+	quiet = 1;
+	srand(1);
+	parse_topology_file(topology_file);
+	base_interval_ms = current_interval_ms = 1000;
+	target_index = my_index;
+	if(entries <= 0 || entries > num_of_servers)
+		entries = num_of_servers; // vectors can not name servers the target does not know
+
+	pkts = (struct load_pkt*)malloc(sizeof(struct load_pkt) * num_of_servers * VARIANTS_PER_SENDER);
+	for(i = 0; i < num_of_servers; i++){
+		if(i == target_index || (!all && servers[i].link_cost == metric_infinity))
+			continue;
+		build_pkts(i, entries);
+	}
+	if(num_of_pkts == 0){
+		printf("Server %d has no neighbors to impersonate, use -a\n", my_id);
+		return -1;
+	}
+
+	memset(&target, 0, sizeof(target));
+	target.sin_family = AF_INET;
+	target.sin_addr.s_addr = servers[target_index].server_ip;
+	target.sin_port = htons(servers[target_index].server_port);
+
+	printf("Sending to server %d on port %d: %d senders impersonated, %d entries (%d bytes) per vector, %d threads, %s\n",
+		my_id, servers[target_index].server_port, num_of_pkts / VARIANTS_PER_SENDER, entries, pkts[0].len,
+		num_of_threads, rate > 0 ? "rate limited" : "unlimited rate");
+
+	drops_before = udp_drops(servers[target_index].server_port);
+	senders = (struct sender*)calloc(num_of_threads, sizeof(struct sender));
+	start = now_s();
+	for(i = 0; i < num_of_threads; i++){
+		senders[i].index = i * VARIANTS_PER_SENDER % num_of_pkts;
+		senders[i].rate = rate / num_of_threads;
+		pthread_create(&senders[i].thread, NULL, sender_main, &senders[i]);
+	}
+
+	while(now_s() - start < duration_s)
+		usleep(10000);
+	running = 0;
+	for(i = 0; i < num_of_threads; i++){
+		pthread_join(senders[i].thread, NULL);
+		pkts_sent += senders[i].pkts_sent;
+		bytes_sent += senders[i].bytes_sent;
+		send_errors += senders[i].send_errors;
+	}
+	elapsed = now_s() - start;
+	drops_after = udp_drops(servers[target_index].server_port);
+
+	printf("Sent %lu pkts (%lu errors) in %.2f s: %.0f pkts/s, %.1f Mbit/s\n",
+		pkts_sent, send_errors, elapsed, pkts_sent / elapsed, bytes_sent * 8 / elapsed / 1e6);
+	if(drops_before >= 0 && drops_after >= 0)
+		printf("Kernel drops on target socket: %ld (%.1f%% of sent)\n", drops_after - drops_before,
+			pkts_sent ? 100.0 * (drops_after - drops_before) / pkts_sent : 0);
+	else
+		printf("Kernel drops on target socket: unknown (target not on this host), see the server's receive path stats\n");
+	return 0;
+}
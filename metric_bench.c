@@ -0,0 +1,266 @@
+/*
+*
+* 	Cost of the bellman_ford() relaxation kernel for the metric width it is built with
+* 	(make metric_bench builds metric_bench16 and metric_bench32), and the number of
+* 	update rounds count-to-infinity takes to end for a given infinity, counted on three
+* 	routers run in this process through the real update, receive and bellman_ford() path
+*
+* 	usage: ./metric_bench16 [num of servers] [num of neighbors] [num of runs] [infinity]
+*
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "router.h"
+
+#define MAX_ROUNDS 1000000L
+#define CHAIN_ROUTERS 3
+
+/* the globals that make up one router, swapped in and out to run several in one process */
+struct router{
+	struct server *servers;
+	metric_t **adj_matrix;
+	struct fib fib;
+	int *advertised;
+	int num_of_advertised;
+	int my_id;
+	int my_index;
+	int my_port;
+	uint32_t my_ip;
+	int alive;
+};
+
+static struct router routers[CHAIN_ROUTERS];
+
+static double elapsed(struct timespec *start, struct timespec *end){
+	return (end->tv_sec - start->tv_sec) + (end->tv_nsec - start->tv_nsec) / 1e9;
+}
+
+/*
+*
+*	Writes a topology where server 1 has num_of_neighbors neighbors
+*
+*	@return
+*		Integer indicating success/failure of function
+*
+*/
+static int write_topology(char *file_name, int num_of_servers, int num_of_neighbors){
+	int fd = mkstemp(file_name), i;
+	FILE *topology;
+
+	if(fd < 0 || (topology = fdopen(fd, "w")) == NULL){
+		perror("topology file");
+		return -1;
+	}
+	fprintf(topology, "%d\n%d\n", num_of_servers, num_of_neighbors);
+	for(i = 1; i <= num_of_servers; i++)
+		fprintf(topology, "%d 127.0.0.1 %d\n", i, 20000 + i);
+	for(i = 2; i <= num_of_neighbors + 1; i++)
+		fprintf(topology, "1 %d %d\n", i, 1 + rand() % 10);
+	fclose(topology);
+	return 1;
+}
+
+static void save_router(struct router *router){
+	router->servers = servers;
+	router->adj_matrix = adj_matrix;
+	router->fib = fib;
+	router->advertised = advertised;
+	router->num_of_advertised = num_of_advertised;
+	router->my_id = my_id;
+	router->my_index = my_index;
+	router->my_port = my_port;
+	router->my_ip = my_ip;
+}
+
+static void load_router(struct router *router){
+	servers = router->servers;
+	adj_matrix = router->adj_matrix;
+	fib = router->fib;
+	advertised = router->advertised;
+	num_of_advertised = router->num_of_advertised;
+	my_id = router->my_id;
+	my_index = router->my_index;
+	my_port = router->my_port;
+	my_ip = router->my_ip;
+}
+
+/*
+*
+*	Loads router router_id of the chain 1 - 2 - ... - CHAIN_ROUTERS, every link costing link_cost
+*
+*	@return
+*		Integer indicating success/failure of function
+*
+*/
+static int load_chain_router(int router_id, metric_t link_cost){
+	char file_name[] = "/tmp/metric_benchXXXXXX";
+	int fd = mkstemp(file_name), i;
+	FILE *topology;
+
+	if(fd < 0 || (topology = fdopen(fd, "w")) == NULL){
+		perror("topology file");
+		return -1;
+	}
+	fprintf(topology, "%d\n%d\n", CHAIN_ROUTERS, router_id == 1 || router_id == CHAIN_ROUTERS ? 1 : 2);
+	for(i = 1; i <= CHAIN_ROUTERS; i++)
+		fprintf(topology, "%d 127.0.0.1 %d\n", i, 20000 + i);
+	if(router_id > 1)
+		fprintf(topology, "%d %d %lu\n", router_id, router_id - 1, (unsigned long)link_cost);
+	if(router_id < CHAIN_ROUTERS)
+		fprintf(topology, "%d %d %lu\n", router_id, router_id + 1, (unsigned long)link_cost);
+	fclose(topology);
+
+	servers = NULL; // every router gets tables of its own
+	advertised = NULL;
+	memset(&fib, 0, sizeof(fib));
+	requested_id = router_id;
+	parse_topology_file(file_name);
+	unlink(file_name);
+	add_own_prefixes();
+	save_router(&routers[router_id - 1]);
+	routers[router_id - 1].alive = 1;
+	return 1;
+}
+
+/*
+*
+*	One update round: every live router builds its update for each live neighbor with
+*	update_pkt_for(), then every neighbor takes it in through deserialize_pkt()
+*
+*	@return
+*		Number of routers whose advertised vector changed
+*
+*/
+static int update_round(){
+	static char legacy_bufs[CHAIN_ROUTERS][MAX_PKT_SIZE], compact_bufs[CHAIN_ROUTERS][MAX_PKT_SIZE];
+	static char *pkts[CHAIN_ROUTERS][CHAIN_ROUTERS];
+	static int lens[CHAIN_ROUTERS][CHAIN_ROUTERS];
+	metric_t before[CHAIN_ROUTERS][CHAIN_ROUTERS];
+	int legacy_len, compact_len, r, i, changed = 0;
+
+	for(r = 0; r < CHAIN_ROUTERS; r++){
+		if(!routers[r].alive)
+			continue;
+		load_router(&routers[r]);
+		memcpy(before[r], adj_matrix[my_index], sizeof(metric_t) * CHAIN_ROUTERS);
+		legacy_len = compact_len = 0;
+		for(i = 0; i < CHAIN_ROUTERS; i++){
+			lens[r][i] = 0;
+			if(servers[i].is_neighbor && servers[i].is_alive)
+				lens[r][i] = update_pkt_for(i, legacy_bufs[r], &legacy_len, compact_bufs[r], &compact_len, &pkts[r][i]);
+		}
+		save_router(&routers[r]);
+	}
+	for(r = 0; r < CHAIN_ROUTERS; r++){
+		if(!routers[r].alive)
+			continue;
+		for(i = 0; i < CHAIN_ROUTERS; i++){
+			if(lens[i][r] == 0 || !routers[i].alive)
+				continue;
+			load_router(&routers[r]);
+			deserialize_pkt(pkts[i][r], lens[i][r]);
+			save_router(&routers[r]);
+		}
+		changed += memcmp(before[r], routers[r].adj_matrix[r], sizeof(metric_t) * CHAIN_ROUTERS) != 0;
+	}
+	return changed;
+}
+
+/*
+*
+*	Converges the chain, then fails its last router and counts the update rounds until
+*	no router has a route to it any more: the rest count to infinity through each other
+*
+*	@return
+*		Number of rounds, -1 if it takes more than MAX_ROUNDS, -2 if routes to the
+*		failed router settle below infinity
+*
+*/
+static long count_to_infinity(metric_t link_cost){
+	int last = CHAIN_ROUTERS - 1, neighbor = CHAIN_ROUTERS - 2, r, reachable;
+	long rounds = 0;
+
+	for(r = 1; r <= CHAIN_ROUTERS; r++){
+		if(load_chain_router(r, link_cost) < 0)
+			return -1;
+	}
+	while(update_round() > 0)
+		;
+
+	routers[last].alive = 0; // its neighbor misses three updates, like main() would see
+	load_router(&routers[neighbor]);
+	servers[last].is_alive = 0;
+	servers[last].is_neighbor = 0;
+	neighbor_down(last);
+	bellman_ford();
+	save_router(&routers[neighbor]);
+
+	do{
+		reachable = 0;
+		for(r = 0; r < last; r++)
+			reachable += routers[r].servers[last].cost < metric_infinity;
+		if(reachable == 0)
+			return rounds;
+		if(++rounds > MAX_ROUNDS)
+			return -1;
+	}while(update_round() > 0);
+	return -2;
+}
+
+int main(int argc, char** argv){
+	int servers_wanted = argc > 1 ? atoi(argv[1]) : 1000;
+	int neighbors_wanted = argc > 2 ? atoi(argv[2]) : 8;
+	int runs = argc > 3 ? atoi(argv[3]) : 200;
+	char topology_file[] = "/tmp/metric_benchXXXXXX";
+	struct timespec start, end;
+	double seconds;
+	long rounds;
+	int i, j;
+
+	if(argc > 4)
+		metric_infinity = strtoul(argv[4], NULL, 10);
+	if(neighbors_wanted >= servers_wanted)
+		neighbors_wanted = servers_wanted - 1;
+
+	srand(42);
+	quiet = 1;
+	requested_id = 1;
+	if(write_topology(topology_file, servers_wanted, neighbors_wanted) < 0)
+		return -1;
+	parse_topology_file(topology_file);
+	unlink(topology_file);
+	add_own_prefixes();
+
+	// neighbors advertise random vectors with a tenth of the servers unreachable
+	for(i = 1; i <= neighbors_wanted; i++){
+		for(j = 0; j < num_of_servers; j++){
+			if(j != i)
+				adj_matrix[i][j] = rand() % 10 == 0 ? metric_infinity : 1 + rand() % 100;
+		}
+	}
+
+	bellman_ford();
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for(i = 0; i < runs; i++)
+		bellman_ford();
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	seconds = elapsed(&start, &end);
+
+	printf("Metric %d bit, infinity %lu: %d servers, %d neighbors, %.1f us per bellman_ford, %.2f ns per relaxation, matrix %lu KB\n",
+		METRIC_BITS, (unsigned long)metric_infinity, num_of_servers, neighbors_wanted, seconds / runs * 1e6,
+		seconds / runs / ((double)num_of_servers * num_of_servers) * 1e9,
+		(unsigned long)num_of_servers * num_of_servers * sizeof(metric_t) / 1024);
+	rounds = count_to_infinity(1);
+	if(rounds == -1)
+		printf("Count to infinity after server %d of a cost 1 chain fails: more than %ld update rounds\n", CHAIN_ROUTERS, MAX_ROUNDS);
+	else if(rounds == -2)
+		printf("Count to infinity after server %d of a cost 1 chain fails: routes to it never withdrawn\n", CHAIN_ROUTERS);
+	else
+		printf("Count to infinity after server %d of a cost 1 chain fails: %ld update rounds\n", CHAIN_ROUTERS, rounds);
+	return 0;
+}
@@ -0,0 +1,171 @@
+/*
+*
+* 	Replays a capture file (server -c) through the receive path and reports
+* 	per packet processing latency and the final routing table
+*
+* 	usage: ./replay -t <topology file name> -f <capture file> [--id <server-ID>] [-r] [-p <prefix/len>]... [-e <event trace file>]
+*
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <time.h>
+
+#include "router.h"
+
+
+/* one captured datagram */
+struct replay_pkt{
+	struct trace_record record;
+	char *data;
+};
+
+static long long now_ns(){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static int compare_ll(const void *a, const void *b){
+	long long x = *(const long long*)a, y = *(const long long*)b;
+	return x < y ? -1 : x > y;
+}
+
+/*
+*
+*	Reads every record of a capture file
+*
+*	@return
+*		Number of records read, -1 on error
+*
+*/
+static int read_trace(char *file_name, struct trace_header *header, struct replay_pkt **pkts){
+	FILE *trace = fopen(file_name, "rb");
+	int count = 0, capacity = 1024;
+	struct replay_pkt *p;
+
+	if(trace == NULL){
+		perror("capture file");
+		return -1;
+	}
+	if(fread(header, sizeof(struct trace_header), 1, trace) != 1 || memcmp(header->magic, TRACE_MAGIC, 4) != 0 || header->version != TRACE_VERSION){
+		printf("%s is not a capture file\n", file_name);
+		fclose(trace);
+		return -1;
+	}
+
+	*pkts = (struct replay_pkt*)malloc(sizeof(struct replay_pkt) * capacity);
+	while(1){
+		if(count == capacity){
+			capacity *= 2;
+			*pkts = (struct replay_pkt*)realloc(*pkts, sizeof(struct replay_pkt) * capacity);
+		}
+		p = &(*pkts)[count];
+		if(fread(&p->record, sizeof(struct trace_record), 1, trace) != 1)
+			break;
+		p->data = (char*)malloc(p->record.len);
+		if(fread(p->data, 1, p->record.len, trace) != p->record.len){
+			printf("Truncated record %d ignored\n", count);
+			free(p->data);
+			break;
+		}
+		count++;
+	}
+
+	fclose(trace);
+	return count;
+}
+
+int main(int argc, char** argv){
+	int c, i, count;
+	int paced = 0;
+	char *topology_file = NULL, *trace_file = NULL, *event_file = NULL;
+	struct trace_header header;
+	struct replay_pkt *pkts;
+	long long *latency_ns, start_ns, first_us, wait_ns, total_ns = 0, replay_start_ns;
+	static char usage[] = "usage: %s -t <topology file name> -f <capture file> [--id <server-ID>] [-r] [-p <prefix/len>]... [-e <event trace file>]\n";
+	static struct option long_options[] = {
+		{"id", required_argument, NULL, 'I'},
+		{NULL, 0, NULL, 0}
+	};
+
+	while((c = getopt_long(argc, argv, "t:f:rp:e:", long_options, NULL)) != -1){
+		switch(c){
+			case 't':
+				topology_file = optarg;
+				break;
+			case 'f':
+				trace_file = optarg;
+				break;
+			case 'r':
+				paced = 1;
+				break;
+			case 'e':
+				event_file = optarg;
+				break;
+			case 'p':
+				if(num_of_own_prefixes < MAX_OWN_PREFIXES)
+					own_prefixes[num_of_own_prefixes++] = optarg;
+				break;
+			case 'I':
+				requested_id = atoi(optarg);
+				break;
+			default:
+				fprintf(stderr, usage, argv[0]);
+				exit(0);
+		}
+	}
+	if(topology_file == NULL || trace_file == NULL){
+		fprintf(stderr, usage, argv[0]);
+		exit(0);
+	}
+
+	count = read_trace(trace_file, &header, &pkts);
+	if(count < 0)
+		return -1;
+	if(requested_id == 0)
+		requested_id = header.my_id;
+
+	quiet = 1;
+	my_socket = -1; // acks, resyncs and updates are built but not sent, see send_to_server()
+	parse_topology_file(topology_file);
+	add_own_prefixes();
+	base_interval_ms = current_interval_ms = 1000;
+	if(event_file != NULL && event_trace_open(event_file, my_id) < 0)
+		return -1;
+
+	printf("Replaying %d packets captured by server %d %s\n", count, header.my_id, paced ? "at recorded pacing" : "as fast as possible");
+
+	latency_ns = (long long*)malloc(sizeof(long long) * (count + 1));
+	first_us = count > 0 ? pkts[0].record.time_us : 0;
+	replay_start_ns = now_ns();
+	for(i = 0; i < count; i++){
+		if(paced){
+			wait_ns = (long long)(pkts[i].record.time_us - first_us) * 1000 - (now_ns() - replay_start_ns);
+			if(wait_ns > 0){
+				struct timespec ts = {wait_ns / 1000000000LL, wait_ns % 1000000000LL};
+				nanosleep(&ts, NULL);
+			}
+		}
+		start_ns = now_ns();
+		deserialize_pkt(pkts[i].data, pkts[i].record.len);
+		latency_ns[i] = now_ns() - start_ns;
+		total_ns += latency_ns[i];
+	}
+
+	if(count > 0){
+		qsort(latency_ns, count, sizeof(long long), compare_ll);
+		printf("Processed %d packets in %.3f ms of processing time, %.0f packets/s\n",
+			count, total_ns / 1e6, count / (total_ns / 1e9));
+		printf("Latency us: min %.2f mean %.2f p50 %.2f p90 %.2f p99 %.2f max %.2f\n",
+			latency_ns[0] / 1e3, total_ns / 1e3 / count, latency_ns[count / 2] / 1e3,
+			latency_ns[(int)(count * 0.9)] / 1e3, latency_ns[(int)(count * 0.99)] / 1e3, latency_ns[count - 1] / 1e3);
+	}
+
+	printf("Final routing table of server %d\n", my_id);
+	display_routes();
+	event_trace_close();
+	return 0;
+}
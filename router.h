@@ -0,0 +1,396 @@
+/*
+*
+* 	Distance vector routing protocol - shared definitions
+*
+* 	Lets tools (replay, benchmarks) link against the router code built with -DROUTER_NO_MAIN.
+*
+*/
+
+#ifndef ROUTER_H
+#define ROUTER_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "fib.h"
+#include "apsp.h"
+#include "event_trace.h"
+#include "rx_shard.h"
+
+#define MAX_PKT_SIZE 65507 // largest UDP payload
+#define MAX_OWN_PREFIXES 64
+#define MAX_LOCAL_IPS 64
+#define ECMP_MAX_PATHS FIB_MAX_PATHS
+
+/* route metric, build with -DMETRIC_BITS=32 for 32 bit costs */
+#ifndef METRIC_BITS
+#define METRIC_BITS 16
+#endif
+#if METRIC_BITS == 32
+typedef uint32_t metric_t;
+#define METRIC_MAX UINT32_MAX
+#else
+typedef uint16_t metric_t;
+#define METRIC_MAX UINT16_MAX
+#endif
+#define WIRE_INFINITY 0xffff // unreachable in the 16 bit cost field of legacy updates
+
+/* extension TLVs appended after the distance vectors. Old receivers stop reading after num_of_updates entries */
+#define TLV_END 0
+#define TLV_PREFIXES 1 // repeated {server_id, len, 0x0, prefix}
+#define TLV_PREFIX_ENTRY_SIZE 8
+#define TLV_INTERVAL 2 // uint32 ms until the sender's next periodic update; dead detection stays on the base interval, kept up by keepalives
+#define TLV_COMPACT 3 // empty, the sender decodes PKT_COMPACT updates
+#define TLV_ACKS 4 // empty, the sender acks updates carrying TLV_SEQ
+#define TLV_SEQ 5 // uint32 sequence number of a reliable (triggered) update, ack it with PKT_ACK
+#define TLV_SEQ_SIZE 8 // serializers leave room to append it after TLV_END
+#define FIXED_TLVS_SIZE 44 // every TLV but TLV_PREFIXES, TLV_END and room for TLV_SEQ
+#define MAX_VECTOR_ENTRIES ((MAX_PKT_SIZE-8-FIXED_TLVS_SIZE)/12) // entries a legacy update has room for
+#define TLV_VERSION 6 // uint32 version of the sender's vector, the sender takes PKT_UNCHANGED keepalives
+#define TLV_RESTART 7 // uint32 ms the sender will be restarting for, keep its vector and routes until then
+
+/* extension packets start with PKT_MAGIC, which a legacy update's num_of_updates never does */
+#define PKT_MAGIC 0xff
+#define PKT_HELLO 1 // {PKT_MAGIC, PKT_HELLO, sender_id, hello interval ms}
+#define HELLO_PKT_SIZE 6
+#define HELLO_DEAD_MULTIPLIER 3 // hellos missed before a neighbor is declared dead
+#define PKT_COMPACT 2 // {PKT_MAGIC, PKT_COMPACT, sender_id, varint count, cost tokens..., TLVs}, costs of ids 1..count
+#define COMPACT_RUN 1 // low bit of a cost token: the rest is a run of unreachable entries
+#define PKT_ACK 3 // {PKT_MAGIC, PKT_ACK, sender_id, uint32 newest sequence number, uint32 bitmap of the ACK_BITMAP_BITS before it}
+#define ACK_PKT_SIZE 12
+#define ACK_BITMAP_BITS 32
+#define PKT_UNCHANGED 4 // {PKT_MAGIC, PKT_UNCHANGED, sender_id, uint32 version, uint32 interval ms}, my vector is still version
+#define UNCHANGED_PKT_SIZE 12
+#define PKT_RESYNC 5 // {PKT_MAGIC, PKT_RESYNC, sender_id}, send me your full vector
+#define RESYNC_PKT_SIZE 4
+
+/* hierarchical areas, on when the topology file gives server lines a 4th column */
+#define ENTRY_AREA 1 // padding of a distance vector entry: server_id is a remote area, cost its summary
+#define PREFIX_AREA 1 // 4th byte of a TLV_PREFIXES entry: server_id is the remote area the prefix lies in
+
+/* reliable triggered updates */
+#define RELIABLE_RTO_MS 200 // first retransmit timeout, doubles per retransmission
+#define RELIABLE_MAX_RETRANSMITS 5 // then the periodic update takes over
+#define RELIABLE_WINDOW 4 // unacked updates in flight per neighbor
+#define ACK_DELAY_MS 10 // acks wait this long so a burst of updates is acked once
+#define RESTART_WINDOW_S 30 // default window of the restart command
+
+#define DEFAULT_JITTER_PERCENT 25
+#define DEFAULT_MAX_BACKOFF 8
+#define DEFAULT_HOLD_DOWN_MS 500
+
+/* route flap damping, RFC 2439 figures of merit */
+#define DAMP_DOWN_PENALTY 1000 // link down or route withdrawn
+#define DAMP_CHANGE_PENALTY 500 // link up or cost change, route back after a withdrawal
+#define DAMP_SUPPRESS 2000
+#define DAMP_REUSE 750
+#define DAMP_CEILING (DAMP_REUSE*16) // suppressed for at most 4 half lives
+
+/* capture file (-c) format: a trace_header, then a trace_record plus datagram per received packet */
+#define TRACE_MAGIC "DVTR"
+#define TRACE_VERSION 1
+
+
+/* flap penalty of a link or route */
+ struct damping{
+	double penalty;
+	long long updated_ms; // when penalty was last decayed
+	int suppressed;
+};
+
+/* data structure for routing table */
+ struct server{
+	uint32_t server_ip;
+	uint16_t server_id;
+	uint16_t server_port;
+	metric_t cost;
+
+	uint16_t area;
+	int is_area; // stands for a whole remote area, server_id is 0
+
+	int is_neighbor;
+	metric_t link_cost; // cost of the direct link, metric_infinity if there is none
+	int num_of_skips;
+	int is_alive;
+	int next_hop;
+
+	uint16_t next_hops[ECMP_MAX_PATHS]; // equal cost next hops, next_hop first
+	uint8_t num_of_next_hops;
+	int backup; // index of the loop-free alternate neighbor, -1 if none
+	int prefix_source; // neighbor whose TLV_PREFIXES set this server's prefixes last, -1 if none
+	uint32_t prefix_tlv; // TLV_PREFIXES that set them, counted by process_prefix_tlv()
+	int num_of_prefix_origins; // servers whose prefix_source this neighbor is
+
+	long long last_heard_ms; // when the last update or hello from this neighbor was accepted
+	uint32_t update_interval_ms; // periodic interval the neighbor advertised
+	long long last_hello_ms; // 0 until the neighbor sends hellos
+	uint16_t hello_interval_ms; // hello interval the neighbor advertised
+	int peer_compact; // neighbor advertised TLV_COMPACT, send it PKT_COMPACT updates
+	int peer_acks; // neighbor advertised TLV_ACKS, triggered updates to it are reliable
+	int peer_versions; // neighbor advertised TLV_VERSION, unchanged periodic updates to it are keepalives
+	uint32_t sent_version; // of my vector last sent in full to this neighbor, 0 for none
+	uint32_t heard_version; // of the neighbor's vector last received in full, 0 for none
+	long long restart_until_ms; // neighbor announced a restart, its routes are kept until then, 0 if none
+
+	uint32_t next_seq; // next reliable update sent to this neighbor
+	uint32_t in_flight[RELIABLE_WINDOW]; // unacked sequence numbers, oldest first
+	int num_in_flight;
+	long long retransmit_ms; // when the newest update in flight is resent
+	int retransmits; // of the newest update in flight
+	int send_deferred; // a reliable update waits for the window to open
+	uint32_t ack_seq; // newest reliable update received from the neighbor, 0 for none; it supersedes the older ones
+	uint32_t ack_bitmap; // bit i: ack_seq-1-i was received too
+	int ack_pending; // the vector being processed carried a TLV_SEQ
+	int ack_due; // an ack goes out at next_ack_ms
+
+	struct damping link_damp; // flaps of the link to this neighbor
+	struct damping route_damp; // flaps of the route to this destination
+	metric_t found_cost; // of the route bellman_ford() last found, cost stays infinity while route_damp suppresses it
+};
+
+/* sent and received traffic, per reporting interval and in total */
+ struct update_stats{
+	unsigned long pkts_sent;
+	unsigned long bytes_sent;
+	unsigned long pkts_received;
+	unsigned long bytes_received;
+	unsigned long periodic_rounds;
+	unsigned long triggered_rounds;
+	unsigned long pkts_processed; // every datagram read from the socket
+	unsigned long acks_received; // reliable updates acked
+	unsigned long retransmits;
+	unsigned long reliable_given_up; // reliable updates never acked
+	unsigned long keepalives_sent; // PKT_UNCHANGED instead of a full periodic vector
+	unsigned long keepalives_received;
+	unsigned long resyncs_sent; // keepalive with a version I do not have
+};
+
+/* data struture for update message */
+/* distance vector format */
+ struct  distance_vector {
+	uint32_t server_ip; 
+	uint16_t server_port;
+	uint16_t padding; 
+	uint16_t server_id; 
+	uint16_t cost; 
+} ;
+
+
+
+/* capture file header */
+ struct trace_header{
+	char magic[4];
+	uint16_t version;
+	uint16_t my_id; // server that captured the trace
+};
+
+/* capture file record, host byte order, followed by len bytes of datagram */
+ struct trace_record{
+	uint64_t time_us; // wall clock receive time
+	uint32_t src_ip;
+	uint16_t src_port;
+	uint16_t len;
+};
+
+/* topology file server line, only kept while parsing */
+ struct topology_entry{
+	uint32_t server_ip;
+	uint16_t server_id;
+	uint16_t server_port;
+	uint16_t area;
+	int keep; // tracked in servers
+};
+
+/* routing packet format */
+ struct routing_update_pkt{
+	uint16_t num_of_updates; 
+	uint16_t sender_port; 
+	uint32_t sender_ip; 
+	struct distance_vector* updates; 
+} ;
+
+extern metric_t ** adj_matrix;
+extern int my_port;
+extern int num_of_servers;
+extern uint32_t my_ip;
+extern char * my_ip_raw;
+extern int my_id;
+extern int my_index;
+extern int areas_enabled;
+extern uint16_t my_area;
+extern int first_area_index;
+extern int *advertised;
+extern int num_of_advertised;
+extern int my_socket;
+extern int requested_id;
+extern char * bind_ip;
+extern struct server *servers;
+extern int num_of_pkts_received;
+extern int quiet;
+extern int compact_updates;
+extern int unchanged_keepalives;
+extern uint32_t vector_version;
+extern long long restart_window_ms;
+extern metric_t metric_infinity;
+extern long long reliable_rto_ms;
+extern long long next_retransmit_ms;
+extern long long next_ack_ms;
+extern uint32_t event_cause;
+extern uint32_t triggered_cause;
+extern int entries_changed;
+extern struct fib fib;
+extern char* own_prefixes[];
+extern int num_of_own_prefixes;
+extern FILE * capture_file;
+extern struct update_stats interval_stats;
+extern struct update_stats total_stats;
+extern long long base_interval_ms;
+extern long long current_interval_ms;
+extern double damp_half_life_ms;
+
+/* identity and topology */
+int read_local_ips();
+int is_local_ip(uint32_t ip);
+int is_me(int server_id,char * server_ip);
+void parse_topology_file(char * topology_file);
+int server_index(int server_id);
+int area_index(int area);
+void build_index_table();
+void learn_area_entry(int sender,metric_t *row,uint16_t flags,uint16_t id,metric_t cost,int *changed);
+void add_own_prefixes();
+
+/* route computation */
+void reset_skip_flag(int server_id);
+void set_next_hop(int index,int hop);
+void store_next_hops(int index,uint16_t *hops,int count);
+int remove_next_hop(int index,int hop);
+void bellman_ford();
+int find_backup(int dest,int *usable,int num_of_usable);
+void refresh_fib();
+void note_route_change();
+
+/* update scheduling */
+long long now_ms();
+long long jittered(long long interval);
+int update_pkt_for(int i,char *legacy_buf,int *legacy_len,char *compact_buf,int *compact_len,char **pkt);
+int send_to_server(int index,void *buf,int len);
+int send_update_to(int i,char *pkt,int pkt_len,int reliable);
+void send_update_pkt(int reliable);
+void send_periodic_update();
+void schedule_triggered_update();
+void send_triggered_update();
+long long next_timer_ms();
+void report_interval_stats();
+void count_skips();
+void check_dead_neighbors();
+
+/* unchanged vector keepalives */
+uint64_t vector_hash();
+void update_vector_version();
+void send_unchanged(int index);
+void send_keepalives();
+void send_resync(int index);
+void process_unchanged(void * packet,int pkt_len);
+void process_resync(void * packet,int pkt_len);
+
+/* graceful restart */
+void announce_restart(int window_s);
+void restart_over(int sender);
+
+/* reliable triggered updates */
+void retransmit_updates();
+void drop_in_flight(int index);
+void update_retransmit_timer();
+void send_ack(int index);
+void note_seq(int index,uint32_t seq);
+void process_ack(void * packet,int pkt_len);
+
+/* hellos */
+void send_hellos();
+void check_hellos();
+void process_hello(void * packet,int pkt_len);
+
+/* flap damping */
+double damp_penalty(struct damping *damp);
+int damp_decay(struct damping *damp);
+int damp_event(struct damping *damp,int penalty);
+void neighbor_down(int index);
+void withdraw_routes_via(int index);
+void neighbor_up(int index);
+void release_damped_links();
+
+/* commands */
+int parse(char* cmd);
+int disable(int server_id);
+int update_link_cost(int from,int to,char* cost);
+int whatif(int id1,int id2,char* cost);
+void whatif_graph(struct apsp *graph,uint32_t *link);
+int whatif_solve(struct apsp *graph,uint32_t *link,int *hops);
+void print_cost(uint32_t cost);
+void print_my_neighbors();
+void display_all_distance_vectors();
+void display_routes();
+void print_next_hops(uint16_t *hops,int count);
+void print_server_id(int index);
+void print_all_servers();
+void display_fib();
+
+/* packets */
+void prepare_update_pkt(struct routing_update_pkt * packet_to_send);
+int serialize_packet(struct routing_update_pkt * packet_to_send,void *serialized_packet);
+int serialize_interval_tlv(void *buf);
+int serialize_version_tlv(void *buf);
+int serialize_restart_tlv(void *buf);
+int serialize_prefix_tlv(void *buf,int space);
+int serialize_flag_tlv(void *buf,uint16_t type);
+int serialize_compact_packet(void *buf);
+int put_varint(uint8_t *buf,uint64_t value);
+uint8_t * get_varint(uint8_t *cur,uint8_t *end,uint64_t *value);
+uint16_t process_pkt(void * packet,int pkt_len);
+uint16_t process_compact_pkt(void * packet,int pkt_len);
+int pkt_sender(void * packet,int pkt_len);
+void vector_received(int sender,int compact);
+void * decode_pkt(void * packet,int pkt_len,int sender,metric_t *row,int *changed);
+void * decode_compact_pkt(void * packet,int pkt_len,metric_t *row,int *changed);
+void process_tlvs(uint16_t sender_id,void * packet,void * pkt_end);
+void process_prefix_tlv(int sender,void * value,int len);
+void deserialize_pkt(void * packet,int pkt_len);
+int accept_vector(int sender,int pkt_len,int64_t start_ns);
+void schedule_ack(int sender);
+void send_due_acks();
+
+/* capture */
+struct sockaddr_in;
+int open_capture_file(char * file_name);
+void capture_pkt(void * packet,int pkt_len,struct sockaddr_in * src);
+
+/* metrics */
+
+/* a + b, saturating at metric_infinity instead of wrapping around to a cheap route */
+static inline metric_t metric_add(metric_t a,metric_t b){
+	metric_t sum=a+b;
+
+	if(sum<a || sum>=metric_infinity)
+		return metric_infinity;
+	return sum;
+}
+
+/* legacy updates carry 16 bit costs; larger 32 bit costs go out as unreachable */
+static inline uint16_t metric_to_wire(metric_t cost){
+	if(cost>=metric_infinity || cost>=WIRE_INFINITY)
+		return WIRE_INFINITY;
+	return cost;
+}
+
+static inline metric_t metric_from_wire(uint16_t cost){
+	if(cost==WIRE_INFINITY || cost>=metric_infinity)
+		return metric_infinity;
+	return cost;
+}
+
+/* entries a distance vector carries: every server, or in area mode the servers of my area and one summary per remote area */
+static inline int is_advertised(int index){
+	return !areas_enabled || servers[index].is_area || servers[index].area==my_area;
+}
+
+#endif
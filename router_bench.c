@@ -0,0 +1,381 @@
+/*
+*
+* 	Benchmarks of the router's hot paths, written as JSON for tracking over time:
+* 	bellman_ford(), encoding and decoding updates, parse_topology_file() and a full
+* 	update and ack round trip over loopback. make bench, bench_opt and bench_san
+* 	build it -O2, -O3 -march=native and with address and undefined behavior
+* 	sanitizers and write bench.json, bench_opt.json and bench_san.json.
+*
+* 	usage: ./router_bench [-t <min seconds per case>] [-s <max num of servers>]
+*
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+
+#include "router.h"
+
+#ifndef BENCH_VARIANT
+#define BENCH_VARIANT "default"
+#endif
+
+#define VARIANTS 2 // vectors with different costs per benchmark, so decoding changes entries
+
+/* a timed operation */
+struct bench_case{
+	void (*run)(void *arg);
+	void *arg;
+};
+
+/* update packets posing as server index 1, a neighbor of server 1 */
+struct bench_pkts{
+	char *data[VARIANTS];
+	int len[VARIANTS];
+	int next;
+};
+
+/* the two ends of the loopback round trip */
+struct bench_sockets{
+	int neighbor;
+	struct sockaddr_in server;
+	char *pkt;
+	int pkt_len;
+	uint32_t seq;
+};
+
+static double min_time = 0.2;
+static int first_result = 1;
+static struct routing_update_pkt *packet;
+
+static double now_s(){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+*
+*	Runs a case, doubling the iterations until they take min_time, and writes its result
+*
+*/
+static void report(const char *name, const char *params, struct bench_case *bench){
+	long iterations = 1, i;
+	double start, elapsed;
+
+	bench->run(bench->arg); // warm up
+	while(1){
+		start = now_s();
+		for(i = 0; i < iterations; i++)
+			bench->run(bench->arg);
+		elapsed = now_s() - start;
+		if(elapsed >= min_time || iterations >= (1L << 30))
+			break;
+		iterations *= elapsed > 0 && min_time / elapsed < 16 ? 2 : 16;
+	}
+	printf("%s\n    {\"name\": \"%s\", \"params\": {%s}, \"iterations\": %ld, \"ns_per_op\": %.1f, \"ops_per_s\": %.1f}",
+		first_result ? "" : ",", name, params, iterations, elapsed / iterations * 1e9, iterations / elapsed);
+	first_result = 0;
+	fflush(stdout);
+}
+
+/*
+*
+*	Writes a topology of num_of_servers on 127.0.0.1 where server 1 has num_of_neighbors
+*	neighbors. port_1 and port_2 are the ports of servers 1 and 2, 0 for made up ones.
+*	Made up ports stay below the ephemeral range, where the round trip's sockets are
+*	bound, since legacy updates name their sender by address and port.
+*
+*	@return
+*		Integer indicating success/failure of function
+*
+*/
+static int write_topology(char *file_name, int num_of_servers, int num_of_neighbors, int port_1, int port_2){
+	int fd = mkstemp(file_name), i;
+	FILE *topology;
+
+	if(fd < 0 || (topology = fdopen(fd, "w")) == NULL){
+		perror("topology file");
+		return -1;
+	}
+	fprintf(topology, "%d\n%d\n", num_of_servers, num_of_neighbors);
+	for(i = 1; i <= num_of_servers; i++)
+		fprintf(topology, "%d 127.0.0.1 %d\n", i, i == 1 && port_1 ? port_1 : i == 2 && port_2 ? port_2 : 20000 + i);
+	for(i = 2; i <= num_of_neighbors + 1; i++)
+		fprintf(topology, "1 %d %d\n", i, 1 + rand() % 10);
+	fclose(topology);
+	return 1;
+}
+
+/* frees what parse_topology_file() allocated */
+static void free_tables(){
+	int i;
+
+	for(i = 0; i < num_of_servers; i++)
+		free(adj_matrix[i]);
+	free(adj_matrix);
+	free(servers);
+	servers = NULL;
+}
+
+/* frees the router loaded by load_router() */
+static void free_router(){
+	if(servers == NULL)
+		return;
+	free_tables();
+	fib_free(&fib);
+	free(packet->updates);
+	free(packet);
+}
+
+/*
+*
+*	Loads a generated topology as server 1, with neighbors advertising random vectors
+*	that leave a tenth of the servers unreachable
+*
+*/
+static int load_router(int servers_wanted, int neighbors_wanted, int port_1, int port_2){
+	char topology_file[] = "/tmp/router_benchXXXXXX";
+	int i, j;
+
+	free_router();
+	if(write_topology(topology_file, servers_wanted, neighbors_wanted, port_1, port_2) < 0)
+		return -1;
+	parse_topology_file(topology_file);
+	unlink(topology_file);
+	add_own_prefixes();
+	for(i = 1; i <= neighbors_wanted; i++){
+		for(j = 0; j < num_of_servers; j++){
+			if(j != i)
+				adj_matrix[i][j] = rand() % 10 == 0 ? metric_infinity : 1 + rand() % 100;
+		}
+	}
+	bellman_ford();
+	packet = (struct routing_update_pkt*)malloc(sizeof(struct routing_update_pkt));
+	packet->updates = (struct distance_vector*)malloc(sizeof(struct distance_vector) * num_of_servers);
+	return 1;
+}
+
+/*
+*
+*	Builds VARIANTS update packets posing as server index 1, like loadgen does
+*
+*	@param compact
+*		1 for PKT_COMPACT updates, 0 for legacy ones
+*
+*/
+static void build_pkts(struct bench_pkts *pkts, int compact){
+	char buf[MAX_PKT_SIZE];
+	int v, j, saved_id = my_id, saved_index = my_index, saved_port = my_port;
+	uint32_t saved_ip = my_ip;
+	metric_t *saved_row = (metric_t*)malloc(sizeof(metric_t) * num_of_servers);
+
+	memcpy(saved_row, adj_matrix[1], sizeof(metric_t) * num_of_servers);
+	my_id = servers[1].server_id;
+	my_index = 1;
+	my_ip = servers[1].server_ip;
+	my_port = servers[1].server_port;
+	for(v = 0; v < VARIANTS; v++){
+		for(j = 0; j < num_of_servers; j++)
+			adj_matrix[1][j] = j == 1 ? 0 : 1 + rand() % 50;
+		if(compact)
+			pkts->len[v] = serialize_compact_packet(buf);
+		else{
+			prepare_update_pkt(packet);
+			pkts->len[v] = serialize_packet(packet, buf);
+		}
+		pkts->data[v] = (char*)malloc(pkts->len[v] + TLV_SEQ_SIZE);
+		memcpy(pkts->data[v], buf, pkts->len[v]);
+	}
+	pkts->next = 0;
+	my_id = saved_id;
+	my_index = saved_index;
+	my_ip = saved_ip;
+	my_port = saved_port;
+	memcpy(adj_matrix[1], saved_row, sizeof(metric_t) * num_of_servers);
+	free(saved_row);
+}
+
+static void free_pkts(struct bench_pkts *pkts){
+	int v;
+
+	for(v = 0; v < VARIANTS; v++)
+		free(pkts->data[v]);
+}
+
+static void run_bellman_ford(void *arg){
+	bellman_ford();
+}
+
+static void run_encode(void *arg){
+	static char buf[MAX_PKT_SIZE];
+
+	prepare_update_pkt(packet);
+	serialize_packet(packet, buf);
+}
+
+static void run_encode_compact(void *arg){
+	static char buf[MAX_PKT_SIZE];
+
+	serialize_compact_packet(buf);
+}
+
+static void run_decode(void *arg){
+	struct bench_pkts *pkts = (struct bench_pkts*)arg;
+
+	process_pkt(pkts->data[pkts->next], pkts->len[pkts->next]);
+	pkts->next = (pkts->next + 1) % VARIANTS;
+}
+
+static void run_decode_compact(void *arg){
+	struct bench_pkts *pkts = (struct bench_pkts*)arg;
+
+	process_compact_pkt(pkts->data[pkts->next], pkts->len[pkts->next]);
+	pkts->next = (pkts->next + 1) % VARIANTS;
+}
+
+static void run_parse(void *arg){
+	parse_topology_file((char*)arg);
+	free_tables();
+}
+
+/*
+*
+*	Sends the update with a new TLV_SEQ from the neighbor's socket, receives and
+*	processes it on my_socket, which acks it, and receives the ack
+*
+*/
+static void run_round_trip(void *arg){
+	struct bench_sockets *sockets = (struct bench_sockets*)arg;
+	char buf[MAX_PKT_SIZE];
+	uint16_t tlv_type = htons(TLV_SEQ), tlv_len = htons(4);
+	uint32_t seq = htonl(++sockets->seq);
+	int len;
+
+	memcpy(sockets->pkt + sockets->pkt_len - 4, &tlv_type, 2);
+	memcpy(sockets->pkt + sockets->pkt_len - 2, &tlv_len, 2);
+	memcpy(sockets->pkt + sockets->pkt_len, &seq, 4);
+	memset(sockets->pkt + sockets->pkt_len + 4, 0, 4); // TLV_END
+	sendto(sockets->neighbor, sockets->pkt, sockets->pkt_len + TLV_SEQ_SIZE, 0, (struct sockaddr*)&sockets->server, sizeof(sockets->server));
+	len = recv(my_socket, buf, sizeof(buf), 0);
+	if(len > 0)
+		deserialize_pkt(buf, len);
+	send_due_acks(); // without waiting out ACK_DELAY_MS
+	recv(sockets->neighbor, buf, sizeof(buf), 0);
+}
+
+static int bound_socket(struct sockaddr_in *addr){
+	socklen_t addr_len = sizeof(struct sockaddr_in);
+	int sock = socket(AF_INET, SOCK_DGRAM, 0);
+
+	memset(addr, 0, sizeof(struct sockaddr_in));
+	addr->sin_family = AF_INET;
+	addr->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if(sock < 0 || bind(sock, (struct sockaddr*)addr, sizeof(struct sockaddr_in)) < 0 || getsockname(sock, (struct sockaddr*)addr, &addr_len) < 0){
+		perror("bench socket");
+		return -1;
+	}
+	return sock;
+}
+
+static void bench_round_trip(int servers_wanted){
+	struct bench_sockets sockets;
+	struct sockaddr_in neighbor_addr;
+	struct bench_pkts pkts;
+	struct bench_case bench = {run_round_trip, &sockets};
+	char params[128];
+
+	my_socket = bound_socket(&sockets.server);
+	sockets.neighbor = bound_socket(&neighbor_addr);
+	if(my_socket < 0 || sockets.neighbor < 0)
+		return;
+	if(load_router(servers_wanted, 8, ntohs(sockets.server.sin_port), ntohs(neighbor_addr.sin_port)) < 0)
+		return;
+	reliable_rto_ms = RELIABLE_RTO_MS;
+	build_pkts(&pkts, 0);
+	sockets.pkt = pkts.data[0];
+	sockets.pkt_len = pkts.len[0];
+	sockets.seq = 0;
+
+	sprintf(params, "\"servers\": %d, \"neighbors\": 8, \"bytes\": %d", num_of_servers, sockets.pkt_len + TLV_SEQ_SIZE);
+	report("round_trip", params, &bench);
+	free_pkts(&pkts);
+	close(my_socket);
+	close(sockets.neighbor);
+}
+
+int main(int argc, char** argv){
+	static int server_counts[] = {100, 1000, 4000};
+	static int neighbor_counts[] = {4, 16, 64};
+	int max_servers = 4000, c, s, n;
+	char params[128], topology_file[] = "/tmp/router_benchXXXXXX";
+	struct bench_pkts pkts;
+	struct bench_case bench;
+
+	while((c = getopt(argc, argv, "t:s:")) != -1){
+		switch(c){
+			case 't':
+				min_time = atof(optarg);
+				break;
+			case 's':
+				max_servers = atoi(optarg);
+				break;
+			default:
+				fprintf(stderr, "usage: %s [-t <min seconds per case>] [-s <max num of servers>]\n", argv[0]);
+				return -1;
+		}
+	}
+
+	srand(42);
+	quiet = 1;
+	requested_id = 1;
+	printf("{\"variant\": \"%s\", \"metric_bits\": %d, \"min_time_s\": %g, \"results\": [", BENCH_VARIANT, METRIC_BITS, min_time);
+
+	for(s = 0; s < 3 && server_counts[s] <= max_servers; s++){
+		for(n = 0; n < 3 && neighbor_counts[n] < server_counts[s]; n++){
+			if(load_router(server_counts[s], neighbor_counts[n], 0, 0) < 0)
+				return -1;
+			bench.run = run_bellman_ford;
+			sprintf(params, "\"servers\": %d, \"neighbors\": %d", server_counts[s], neighbor_counts[n]);
+			report("bellman_ford", params, &bench);
+		}
+
+		sprintf(params, "\"servers\": %d", server_counts[s]);
+		if(load_router(server_counts[s], 8, 0, 0) < 0)
+			return -1;
+		bench.run = run_encode;
+		report("encode", params, &bench);
+		bench.run = run_encode_compact;
+		report("encode_compact", params, &bench);
+
+		build_pkts(&pkts, 0);
+		bench.run = run_decode;
+		bench.arg = &pkts;
+		report("decode", params, &bench);
+		free_pkts(&pkts);
+		build_pkts(&pkts, 1);
+		bench.run = run_decode_compact;
+		report("decode_compact", params, &bench);
+		free_pkts(&pkts);
+
+		free_router();
+		strcpy(topology_file, "/tmp/router_benchXXXXXX");
+		if(write_topology(topology_file, server_counts[s], 64 < server_counts[s] ? 64 : server_counts[s] - 1, 0, 0) < 0)
+			return -1;
+		bench.run = run_parse;
+		bench.arg = topology_file;
+		report("parse_topology_file", params, &bench);
+		unlink(topology_file);
+
+		if(server_counts[s] <= 1000)
+			bench_round_trip(server_counts[s]);
+	}
+
+	printf("\n]}\n");
+	free_router();
+	return 0;
+}
@@ -0,0 +1,781 @@
+/*
+*
+* 	Regression checks of the router's core paths, run by make test along with a
+* 	replay of the capture in tests/: update round trips, bellman_ford() on known
+* 	topologies, neighbor liveness, reliable updates and keepalives, alternates,
+* 	restarts, areas, receive shards, whatif, metrics and the FIB. Prints a line per
+* 	check and exits with the number of failed checks.
+*
+* 	usage: ./router_test
+*
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+
+#include "router.h"
+
+static int failures;
+
+static void check(int ok, const char *name, const char *detail){
+	printf("%s %s%s%s\n", ok ? "PASS" : "FAIL", name, ok || detail == NULL ? "" : ": ", ok || detail == NULL ? "" : detail);
+	if(!ok)
+		failures++;
+}
+
+/* frees what parse_topology_file() allocated */
+static void free_tables(){
+	int i;
+
+	if(servers == NULL)
+		return;
+	for(i = 0; i < num_of_servers; i++)
+		free(adj_matrix[i]);
+	free(adj_matrix);
+	free(servers);
+	servers = NULL;
+	fib_free(&fib);
+}
+
+/*
+*
+*	Loads a topology of servers_wanted servers on 127.0.0.1 as server 1
+*
+*	@param areas
+*		Area of each server in server ID order, NULL for a topology without areas
+*
+*	@param links
+*		Link lines of the topology file, "1 2 1\n1 3 5\n" and so on
+*
+*	@return
+*		Integer indicating success/failure of function
+*
+*/
+static int load_area_topology(int servers_wanted, const int *areas, const char *links){
+	char file_name[] = "/tmp/router_testXXXXXX";
+	int fd = mkstemp(file_name), num_of_links = 0, i;
+	FILE *topology;
+
+	if(fd < 0 || (topology = fdopen(fd, "w")) == NULL){
+		perror("topology file");
+		return -1;
+	}
+	for(i = 0; links[i] != '\0'; i++)
+		num_of_links += links[i] == '\n';
+	fprintf(topology, "%d\n%d\n", servers_wanted, num_of_links);
+	for(i = 1; i <= servers_wanted; i++){
+		if(areas != NULL)
+			fprintf(topology, "%d 127.0.0.1 %d %d\n", i, 20000 + i, areas[i - 1]);
+		else
+			fprintf(topology, "%d 127.0.0.1 %d\n", i, 20000 + i);
+	}
+	fprintf(topology, "%s", links);
+	fclose(topology);
+	free_tables();
+	parse_topology_file(file_name);
+	unlink(file_name);
+	add_own_prefixes();
+	return 1;
+}
+
+static int load_topology(int servers_wanted, const char *links){
+	return load_area_topology(servers_wanted, NULL, links);
+}
+
+/* encodes and decodes as the server at index, like a neighbor would */
+static int saved_id, saved_index, saved_port;
+static uint32_t saved_ip;
+
+static void pose_as(int index){
+	saved_id = my_id;
+	saved_index = my_index;
+	saved_ip = my_ip;
+	saved_port = my_port;
+	my_id = servers[index].server_id;
+	my_index = index;
+	my_ip = servers[index].server_ip;
+	my_port = servers[index].server_port;
+}
+
+static void stop_posing(){
+	my_id = saved_id;
+	my_index = saved_index;
+	my_ip = saved_ip;
+	my_port = saved_port;
+}
+
+/* sets the row of the server with server_id to costs, listed in server ID order */
+static void set_row(int server_id, const metric_t *costs){
+	memcpy(adj_matrix[server_index(server_id)], costs, sizeof(metric_t) * num_of_servers);
+}
+
+/* 1 if server_id's route has cost and exactly the count next hops listed */
+static int route_is(int server_id, metric_t cost, const uint16_t *hops, int count){
+	struct server *server = &servers[server_index(server_id)];
+	int i, k;
+
+	if(server->cost != cost || server->num_of_next_hops != count)
+		return 0;
+	for(i = 0; i < count; i++){
+		for(k = 0; k < count && server->next_hops[k] != hops[i]; k++)
+			;
+		if(k == count)
+			return 0;
+	}
+	return 1;
+}
+
+/*
+*
+*	Encodes a vector posing as neighbor index 1, like loadgen does, and decodes it
+*	back into index 1's row
+*
+*	@param compact
+*		1 for PKT_COMPACT updates, 0 for legacy ones
+*
+*/
+static void test_round_trip(int compact){
+	static char buf[MAX_PKT_SIZE];
+	struct routing_update_pkt packet;
+	metric_t *expected;
+	int len, j, same;
+	uint16_t sender_id;
+	char detail[128];
+
+	if(load_topology(40, "1 2 1\n1 3 2\n1 4 3\n1 5 4\n") < 0)
+		return;
+	expected = (metric_t*)malloc(sizeof(metric_t) * num_of_servers);
+	packet.updates = (struct distance_vector*)malloc(sizeof(struct distance_vector) * num_of_servers);
+	for(j = 0; j < num_of_servers; j++) // long runs of unreachable servers and costs of every varint length
+		expected[j] = j == 1 ? 0 : j % 7 < 3 ? metric_infinity : (metric_t)(1 + j * j * 37 % 20000);
+
+	pose_as(1);
+	memcpy(adj_matrix[1], expected, sizeof(metric_t) * num_of_servers);
+	if(compact)
+		len = serialize_compact_packet(buf);
+	else{
+		prepare_update_pkt(&packet);
+		len = serialize_packet(&packet, buf);
+	}
+	stop_posing();
+
+	for(j = 0; j < num_of_servers; j++)
+		adj_matrix[1][j] = 5;
+	sender_id = compact ? process_compact_pkt(buf, len) : process_pkt(buf, len);
+	same = memcmp(adj_matrix[1], expected, sizeof(metric_t) * num_of_servers) == 0;
+	sprintf(detail, "sender %d, %d bytes", sender_id, len);
+	check(sender_id == 2 && same, compact ? "compact round trip" : "legacy round trip", detail);
+	free(packet.updates);
+	free(expected);
+}
+
+/* a diamond, both ways to server 4 cost 2 */
+static void test_bellman_ford_ecmp(){
+	metric_t inf = metric_infinity;
+	metric_t row_2[] = {1, 0, inf, 1}, row_3[] = {1, inf, 0, 1};
+	uint16_t hops_2[] = {2}, hops_3[] = {3}, hops_4[] = {2, 3};
+
+	if(load_topology(4, "1 2 1\n1 3 1\n") < 0)
+		return;
+	set_row(2, row_2);
+	set_row(3, row_3);
+	bellman_ford();
+	check(route_is(2, 1, hops_2, 1) && route_is(3, 1, hops_3, 1) && route_is(4, 2, hops_4, 2), "bellman_ford diamond", NULL);
+}
+
+/*
+*
+*	A triangle where the direct link to server 3 costs more than the way through 2:
+*	the direct link must not join the equal cost set at 2's cost, and when 2 dies the
+*	route must go back to the link's own cost
+*
+*/
+static void test_bellman_ford_link_cost(){
+	metric_t row_2[] = {3, 0, 1}, row_3[] = {5, 1, 0};
+	uint16_t hops_2[] = {2}, hops_3[] = {3};
+	int index;
+
+	if(load_topology(3, "1 2 3\n1 3 5\n") < 0)
+		return;
+	set_row(2, row_2);
+	set_row(3, row_3);
+	bellman_ford();
+	check(route_is(3, 4, hops_2, 1), "bellman_ford direct link not equal cost", NULL);
+
+	index = server_index(2);
+	servers[index].is_alive = 0;
+	servers[index].is_neighbor = 0;
+	neighbor_down(index);
+	bellman_ford();
+	check(route_is(3, 5, hops_3, 1), "bellman_ford falls back to direct link cost", NULL);
+}
+
+/* a neighbor's cost to server 3 going up raises mine, instead of the old cost staying */
+static void test_bellman_ford_cost_increase(){
+	metric_t row_2[] = {1, 0, 3}, worse_2[] = {1, 0, 10}, row_3[] = {20, 10, 0};
+	uint16_t hops_2[] = {2};
+
+	if(load_topology(3, "1 2 1\n1 3 20\n") < 0)
+		return;
+	set_row(2, row_2);
+	set_row(3, row_3);
+	bellman_ford();
+	set_row(2, worse_2);
+	bellman_ford();
+	check(route_is(3, 11, hops_2, 1), "bellman_ford follows a cost increase", NULL);
+}
+
+/* a neighbor silent for 3 base intervals is dead however far it backed off, and a backed off router keeps neighbors up */
+static void test_dead_neighbor(){
+	int index;
+
+	if(load_topology(3, "1 2 1\n1 3 1\n") < 0)
+		return;
+	base_interval_ms = 1000;
+	index = server_index(2);
+	servers[index].update_interval_ms = 8 * base_interval_ms; // what it advertised after backing off
+	servers[index].last_heard_ms = now_ms() - 2 * base_interval_ms - 100;
+	servers[server_index(3)].last_heard_ms = now_ms();
+	count_skips();
+	check_dead_neighbors();
+	check(servers[index].is_alive, "neighbor silent for 2 base intervals kept", NULL);
+	servers[index].last_heard_ms = now_ms() - 3 * base_interval_ms;
+	count_skips();
+	check_dead_neighbors();
+	check(!servers[index].is_alive && servers[server_index(3)].is_alive, "neighbor silent for 3 base intervals dead", NULL);
+
+	servers[server_index(3)].peer_versions = 1;
+	update_vector_version();
+	servers[server_index(3)].sent_version = vector_version;
+	memset(&interval_stats, 0, sizeof(interval_stats));
+	send_keepalives();
+	check(interval_stats.keepalives_sent == 1 && interval_stats.pkts_sent == 1, "backed off router sends keepalives", NULL);
+}
+
+/* builds the ack server_id would send for seq and bitmap */
+static void ack_from(int server_id, uint32_t seq, uint32_t bitmap){
+	uint8_t ack[ACK_PKT_SIZE];
+	uint16_t id = htons(server_id);
+
+	ack[0] = PKT_MAGIC;
+	ack[1] = PKT_ACK;
+	memcpy(ack + 2, &id, 2);
+	seq = htonl(seq);
+	bitmap = htonl(bitmap);
+	memcpy(ack + 4, &seq, 4);
+	memcpy(ack + 8, &bitmap, 4);
+	process_ack(ack, sizeof(ack));
+}
+
+/* a burst of reliable updates gets one ack naming all of them, and acks only count from live neighbors */
+static void test_selective_acks(){
+	int index, i;
+
+	if(load_topology(3, "1 2 1\n") < 0)
+		return;
+	index = server_index(2);
+	memset(&interval_stats, 0, sizeof(interval_stats));
+	for(i = 1; i <= 4; i++){
+		if(i != 3) // lost
+			note_seq(index, i);
+		schedule_ack(index);
+	}
+	send_due_acks();
+	check(interval_stats.pkts_sent == 1 && servers[index].ack_seq == 4 && servers[index].ack_bitmap == 0x6, "burst acked once with a bitmap", NULL);
+
+	servers[index].num_in_flight = 3;
+	servers[index].in_flight[0] = 7;
+	servers[index].in_flight[1] = 8;
+	servers[index].in_flight[2] = 9;
+	ack_from(3, 9, 0x3); // not a neighbor
+	check(servers[index].num_in_flight == 3, "ack from a non-neighbor dropped", NULL);
+	memset(&interval_stats, 0, sizeof(interval_stats));
+	ack_from(2, 8, 0x0); // 7 was superseded, its ack lost
+	check(servers[index].num_in_flight == 1 && servers[index].in_flight[0] == 9 && interval_stats.acks_received == 1, "ack clears the acked and older updates", NULL);
+	servers[index].num_in_flight = 0;
+}
+
+/* number of prefixes the fib holds for server_id */
+static int prefixes_of(int server_id){
+	int i, count = 0;
+
+	for(i = 0; i < fib.num_of_prefixes; i++)
+		count += fib.prefixes[i].dest == server_index(server_id);
+	return count;
+}
+
+/*
+*
+*	Processes a TLV_PREFIXES from sender_id listing num_of_origins origins from 2 on,
+*	each with one prefix 10.<origin>.0.0/16
+*
+*/
+static void prefixes_from(int sender_id, int num_of_origins){
+	uint8_t tlv[4 + 3 * TLV_PREFIX_ENTRY_SIZE], *entry = tlv + 4;
+	uint16_t tlv_type = htons(TLV_PREFIXES), tlv_len = htons(num_of_origins * TLV_PREFIX_ENTRY_SIZE), origin;
+	uint32_t prefix;
+	int i;
+
+	memcpy(tlv, &tlv_type, 2);
+	memcpy(tlv + 2, &tlv_len, 2);
+	for(i = 0; i < num_of_origins; i++, entry += TLV_PREFIX_ENTRY_SIZE){
+		origin = htons(2 + i);
+		prefix = htonl(10u << 24 | (2 + i) << 16);
+		memcpy(entry, &origin, 2);
+		entry[2] = 16;
+		entry[3] = 0;
+		memcpy(entry + 4, &prefix, 4);
+	}
+	process_tlvs(sender_id, tlv, entry);
+}
+
+/* prefixes left out by the neighbor that set them are withdrawn, all of its own by an empty TLV */
+static void test_prefix_withdrawal(){
+	if(load_topology(3, "1 2 3\n1 3 5\n") < 0)
+		return;
+	prefixes_from(2, 2);
+	check(prefixes_of(2) == 1 && prefixes_of(3) == 1, "prefixes learned", NULL);
+	prefixes_from(2, 1);
+	check(prefixes_of(2) == 1 && prefixes_of(3) == 0, "prefix left out withdrawn", NULL);
+	prefixes_from(3, 2);
+	prefixes_from(2, 1);
+	check(prefixes_of(3) == 1, "prefix left out by another neighbor kept", NULL);
+	prefixes_from(2, 0);
+	check(prefixes_of(2) == 0 && prefixes_of(3) == 1, "empty prefix TLV withdraws the sender's", NULL);
+}
+
+/* route damping charges withdrawals and routes coming back, not learning or better paths */
+static void test_route_damping(){
+	metric_t inf = metric_infinity;
+	metric_t row_2[] = {3, 0, 8}, better_2[] = {3, 0, 1}, lost_2[] = {3, 0, inf};
+	struct damping *damp;
+
+	if(load_topology(3, "1 2 3\n") < 0)
+		return;
+	damp_half_life_ms = 60000;
+	damp = &servers[server_index(3)].route_damp;
+	set_row(2, row_2);
+	bellman_ford();
+	set_row(2, better_2);
+	bellman_ford();
+	check(servers[server_index(3)].cost == 4 && damp->penalty == 0, "route damping ignores learning and improvements", NULL);
+	set_row(2, lost_2);
+	bellman_ford();
+	set_row(2, better_2);
+	bellman_ford();
+	check(damp->penalty > DAMP_DOWN_PENALTY && !damp->suppressed, "route damping charges a flap", NULL);
+
+	set_row(2, lost_2);
+	bellman_ford();
+	set_row(2, better_2);
+	bellman_ford();
+	check(damp->suppressed && servers[server_index(3)].cost == metric_infinity && adj_matrix[my_index][server_index(3)] == metric_infinity,
+		"suppressed route neither used nor advertised", NULL);
+	damp->updated_ms -= 3 * damp_half_life_ms; // its penalty decays below DAMP_REUSE
+	release_damped_links();
+	check(!damp->suppressed && servers[server_index(3)].cost == 4 && adj_matrix[my_index][server_index(3)] == 4, "route comes back after reuse", NULL);
+	damp_half_life_ms = 0;
+}
+
+/* builds a TLV carrying one uint32 value */
+static int tlv_u32(uint8_t *tlv, uint16_t type, uint32_t value){
+	uint16_t tlv_type = htons(type), tlv_len = htons(4);
+
+	value = htonl(value);
+	memcpy(tlv, &tlv_type, 2);
+	memcpy(tlv + 2, &tlv_len, 2);
+	memcpy(tlv + 4, &value, 4);
+	return 8;
+}
+
+/* builds the keepalive server_id would send for its vector version */
+static void unchanged_from(uint8_t *unchanged, int server_id, uint32_t version){
+	uint16_t id = htons(server_id);
+	uint32_t interval = htonl(1000);
+
+	unchanged[0] = PKT_MAGIC;
+	unchanged[1] = PKT_UNCHANGED;
+	memcpy(unchanged + 2, &id, 2);
+	version = htonl(version);
+	memcpy(unchanged + 4, &version, 4);
+	memcpy(unchanged + 8, &interval, 4);
+}
+
+/* a neighbor that stops sending hellos is dead after HELLO_DEAD_MULTIPLIER of them, one that keeps sending stays up */
+static void test_hellos(){
+	uint8_t hello[HELLO_PKT_SIZE];
+	uint16_t id = htons(3), interval = htons(100);
+	int index_2, index_3;
+
+	if(load_topology(3, "1 2 1\n1 3 1\n") < 0)
+		return;
+	index_2 = server_index(2);
+	index_3 = server_index(3);
+	servers[index_2].hello_interval_ms = servers[index_3].hello_interval_ms = 100;
+	servers[index_2].last_hello_ms = servers[index_3].last_hello_ms = now_ms() - 4 * 100;
+	hello[0] = PKT_MAGIC;
+	hello[1] = PKT_HELLO;
+	memcpy(hello + 2, &id, 2);
+	memcpy(hello + 4, &interval, 2);
+	process_hello(hello, sizeof(hello));
+	check_hellos();
+	check_dead_neighbors();
+	check(!servers[index_2].is_alive && servers[index_3].is_alive, "missed hellos declare a neighbor dead", NULL);
+}
+
+/* reliable updates fill the window, wait for it to open, are retransmitted and given up on */
+static void test_reliable_updates(){
+	static char legacy_buf[MAX_PKT_SIZE], compact_buf[MAX_PKT_SIZE];
+	int legacy_len = 0, compact_len = 0, pkt_len, index, i;
+	char *pkt;
+
+	if(load_topology(3, "1 2 1\n") < 0)
+		return;
+	index = server_index(2);
+	servers[index].peer_acks = 1;
+	memset(&interval_stats, 0, sizeof(interval_stats));
+	pkt_len = update_pkt_for(index, legacy_buf, &legacy_len, compact_buf, &compact_len, &pkt);
+	for(i = 0; i <= RELIABLE_WINDOW; i++)
+		send_update_to(index, pkt, pkt_len, 1);
+	check(servers[index].num_in_flight == RELIABLE_WINDOW && servers[index].send_deferred && interval_stats.pkts_sent == RELIABLE_WINDOW,
+		"full window defers the update", NULL);
+	ack_from(2, RELIABLE_WINDOW, 0x7);
+	check(interval_stats.acks_received == RELIABLE_WINDOW && servers[index].num_in_flight == 1 && servers[index].in_flight[0] == RELIABLE_WINDOW + 1
+		&& !servers[index].send_deferred, "ack opens the window for the deferred update", NULL);
+
+	servers[index].retransmit_ms = now_ms() - 1;
+	retransmit_updates();
+	check(interval_stats.retransmits == 1 && servers[index].num_in_flight == 1 && servers[index].in_flight[0] == RELIABLE_WINDOW + 2
+		&& servers[index].retransmits == 1, "unacked update retransmitted", NULL);
+	servers[index].retransmits = RELIABLE_MAX_RETRANSMITS;
+	servers[index].retransmit_ms = now_ms() - 1;
+	retransmit_updates();
+	check(interval_stats.reliable_given_up == 1 && servers[index].num_in_flight == 0, "update given up after the last retransmit", NULL);
+}
+
+/* a keepalive naming the vector I hold only refreshes the neighbor, any other version asks for a resync */
+static void test_unchanged_vectors(){
+	uint8_t tlv[8], unchanged[UNCHANGED_PKT_SIZE], resync[RESYNC_PKT_SIZE];
+	uint16_t id = htons(3);
+	int index;
+
+	if(load_topology(3, "1 2 1\n1 3 1\n") < 0)
+		return;
+	index = server_index(2);
+	process_tlvs(2, tlv, tlv + tlv_u32(tlv, TLV_VERSION, 7));
+	memset(&interval_stats, 0, sizeof(interval_stats));
+	unchanged_from(unchanged, 2, 7);
+	process_unchanged(unchanged, sizeof(unchanged));
+	check(interval_stats.keepalives_received == 1 && interval_stats.resyncs_sent == 0, "keepalive for the vector held", NULL);
+	unchanged_from(unchanged, 2, 8);
+	process_unchanged(unchanged, sizeof(unchanged));
+	check(interval_stats.keepalives_received == 1 && interval_stats.resyncs_sent == 1 && interval_stats.pkts_sent == 1,
+		"keepalive for a missed vector asks for a resync", NULL);
+
+	resync[0] = PKT_MAGIC;
+	resync[1] = PKT_RESYNC;
+	memcpy(resync + 2, &id, 2);
+	servers[server_index(3)].sent_version = vector_version;
+	process_resync(resync, sizeof(resync));
+	check(interval_stats.pkts_sent == 2 && interval_stats.keepalives_sent == 0 && servers[server_index(3)].sent_version == vector_version
+		&& servers[index].sent_version == 0, "resync answered with the full vector", NULL);
+}
+
+/*
+*
+*	Server 4 is reached through 2; 3 is a loop-free alternate when its own distance to 4
+*	is shorter than going back through me, and takes over when 2 goes down
+*
+*/
+static void test_loop_free_alternates(){
+	metric_t inf = metric_infinity;
+	metric_t row_2[] = {1, 0, inf, 1}, row_3[] = {2, inf, 0, 1}, looping_3[] = {2, inf, 0, 5};
+	uint16_t hops_2[] = {2}, hops_3[] = {3};
+	int index;
+
+	if(load_topology(4, "1 2 1\n1 3 2\n") < 0)
+		return;
+	set_row(2, row_2);
+	set_row(3, row_3);
+	bellman_ford();
+	check(route_is(4, 2, hops_2, 1) && servers[server_index(4)].backup == server_index(3), "loop-free alternate found", NULL);
+	index = server_index(2);
+	servers[index].is_alive = 0;
+	servers[index].is_neighbor = 0;
+	neighbor_down(index);
+	check(route_is(4, 3, hops_3, 1), "route fails over to its alternate", NULL);
+
+	if(load_topology(4, "1 2 1\n1 3 2\n") < 0)
+		return;
+	set_row(2, row_2);
+	set_row(3, looping_3);
+	bellman_ford();
+	check(servers[server_index(4)].backup == -1, "neighbor routing back through me is no alternate", NULL);
+	index = server_index(2);
+	servers[index].is_alive = 0;
+	servers[index].is_neighbor = 0;
+	neighbor_down(index);
+	check(servers[server_index(4)].cost == metric_infinity, "route without an alternate withdrawn", NULL);
+}
+
+/* a restarting neighbor's routes stay through its window, and go when it does not come back in time */
+static void test_restart_window(){
+	metric_t row_2[] = {1, 0, 1};
+	uint16_t hops_2[] = {2};
+	uint8_t tlv[8];
+	int index;
+
+	if(load_topology(3, "1 2 1\n") < 0)
+		return;
+	index = server_index(2);
+	set_row(2, row_2);
+	bellman_ford();
+	process_tlvs(2, tlv, tlv + tlv_u32(tlv, TLV_RESTART, 60000));
+	servers[index].last_heard_ms = now_ms() - 5 * base_interval_ms;
+	count_skips();
+	check_dead_neighbors();
+	bellman_ford();
+	check(servers[index].is_alive && route_is(3, 2, hops_2, 1), "restarting neighbor kept in its window", NULL);
+	servers[index].restart_until_ms = now_ms() - 1;
+	check_dead_neighbors();
+	check(!servers[index].is_alive && servers[index].restart_until_ms == 0 && servers[server_index(3)].cost == metric_infinity,
+		"neighbor not back from its restart dropped", NULL);
+}
+
+/* appends a legacy distance vector entry */
+static uint8_t *vector_entry(uint8_t *entry, uint16_t flags, uint16_t id, uint16_t cost){
+	flags = htons(flags);
+	id = htons(id);
+	cost = htons(cost);
+	memset(entry, 0, 6);
+	memcpy(entry + 6, &flags, 2);
+	memcpy(entry + 8, &id, 2);
+	memcpy(entry + 10, &cost, 2);
+	return entry + 12;
+}
+
+/*
+*
+*	Servers 1 and 2 are area 0, 3 and 4 area 1, 5 area 2. My neighbor 3 sums up
+*	area 1 and passes on area 2; I advertise my area and one entry per remote area,
+*	not the border server 3
+*
+*/
+static void test_areas(){
+	static const int areas[] = {0, 0, 1, 1, 2};
+	uint8_t pkt[8 + 4 * 12 + 4], *cur = pkt;
+	uint16_t count = htons(4), port = htons(20003);
+	uint32_t ip;
+	struct routing_update_pkt packet;
+	int i, index_3, entries_of_3 = 0, area_2_cost = -1;
+
+	if(load_area_topology(5, areas, "1 2 1\n1 3 2\n") < 0)
+		return;
+	index_3 = server_index(3);
+	ip = htonl(servers[index_3].server_ip);
+	memcpy(cur, &count, 2);
+	memcpy(cur + 2, &port, 2);
+	memcpy(cur + 4, &ip, 4);
+	cur = vector_entry(cur + 8, 0, 3, 0);
+	cur = vector_entry(cur, 0, 4, 1);
+	cur = vector_entry(cur, ENTRY_AREA, 0, 2); // my own area, known in detail
+	cur = vector_entry(cur, ENTRY_AREA, 2, 5);
+	memset(cur, 0, 4);
+	cur += 4;
+	check(process_pkt(pkt, cur - pkt) == 3, "vector from another area accepted", NULL);
+	bellman_ford();
+	check(num_of_servers == 5 && server_index(4) < 0 && servers[area_index(1)].cost == 2 && servers[area_index(2)].cost == 7,
+		"area summaries routed through the border", NULL);
+
+	packet.updates = (struct distance_vector*)malloc(sizeof(struct distance_vector) * num_of_servers);
+	prepare_update_pkt(&packet);
+	for(i = 0; i < ntohs(packet.num_of_updates); i++){
+		if(ntohs(packet.updates[i].padding) == 0 && ntohs(packet.updates[i].server_id) == 3)
+			entries_of_3++;
+		if(ntohs(packet.updates[i].padding) == ENTRY_AREA && ntohs(packet.updates[i].server_id) == 2)
+			area_2_cost = ntohs(packet.updates[i].cost);
+	}
+	check(ntohs(packet.num_of_updates) == 4 && entries_of_3 == 0 && area_2_cost == 7, "border advertises area summaries only", NULL);
+	free(packet.updates);
+}
+
+/*
+*
+*	Stages three vectors from neighbor 2 between a stale keepalive and a current one,
+*	as receive shards would: the merge takes only the last vector, drops the keepalive
+*	it superseded and counts the one that came after it
+*
+*/
+static void test_rx_shard_merge(){
+	static char buf[MAX_PKT_SIZE];
+	metric_t row_2[] = {1, 0, metric_infinity};
+	uint8_t unchanged[UNCHANGED_PKT_SIZE];
+	struct routing_update_pkt packet;
+	struct sockaddr_in addr;
+	uint16_t hops_2[] = {2};
+	uint32_t saved_version = vector_version;
+	int len, k;
+
+	if(load_topology(3, "1 2 1\n1 3 10\n") < 0)
+		return;
+	memset(&addr, 0, sizeof(addr));
+	rx_shards = 1; // slots and the merge, no threads
+	if(rx_shard_start(&addr) < 0)
+		return;
+	memset(&interval_stats, 0, sizeof(interval_stats));
+	unchanged_from(unchanged, 2, 100);
+	rx_shard_stage(unchanged, sizeof(unchanged));
+	packet.updates = (struct distance_vector*)malloc(sizeof(struct distance_vector) * num_of_servers);
+	for(k = 1; k <= 3; k++){
+		pose_as(server_index(2));
+		adj_matrix[my_index][server_index(3)] = k;
+		vector_version = 100 + k;
+		prepare_update_pkt(&packet);
+		len = serialize_packet(&packet, buf);
+		stop_posing();
+		rx_shard_stage(buf, len);
+	}
+	vector_version = saved_version;
+	set_row(2, row_2);
+	unchanged_from(unchanged, 2, 103);
+	rx_shard_stage(unchanged, sizeof(unchanged));
+	rx_shard_merge();
+	check(adj_matrix[server_index(2)][server_index(3)] == 3 && route_is(3, 4, hops_2, 1), "shards merge the latest vector", NULL);
+	check(interval_stats.keepalives_received == 1 && interval_stats.resyncs_sent == 0, "shards merge keepalives in arrival order", NULL);
+	free(packet.updates);
+}
+
+/*
+*
+*	Runs whatif with stdout captured to file
+*
+*	@return
+*		whatif()'s return value
+*
+*/
+static int whatif_output(int id1, int id2, char *cost, char *output, int size){
+	FILE *capture = tmpfile();
+	int saved_stdout = dup(STDOUT_FILENO), result, len;
+
+	fflush(stdout);
+	dup2(fileno(capture), STDOUT_FILENO);
+	result = whatif(id1, id2, cost);
+	fflush(stdout);
+	dup2(saved_stdout, STDOUT_FILENO);
+	close(saved_stdout);
+	rewind(capture);
+	len = fread(output, 1, size - 1, capture);
+	output[len] = '\0';
+	fclose(capture);
+	return result;
+}
+
+/* whatif reports the routes a cost change of my link would move, without moving them */
+static void test_whatif(){
+	metric_t row_2[] = {1, 0, 1}, row_3[] = {5, 1, 0};
+	uint16_t hops_2[] = {2};
+	char output[4096];
+
+	if(load_topology(3, "1 2 1\n1 3 5\n") < 0)
+		return;
+	set_row(2, row_2);
+	set_row(3, row_3);
+	bellman_ford();
+	check(whatif_output(1, 2, "10", output, sizeof(output)) > 0 && strstr(output, "2\t\t 1 -> 6\t 2 -> 3\n") != NULL
+		&& strstr(output, "3\t\t 2 -> 5\t 2 -> 3\n") != NULL && strstr(output, "2 of my routes") != NULL, "whatif before and after", output);
+	check(route_is(2, 1, hops_2, 1) && route_is(3, 2, hops_2, 1), "whatif leaves live routes alone", NULL);
+	check(whatif_output(2, 3, "10", output, sizeof(output)) < 0, "whatif rejects links of other servers", NULL);
+	servers[server_index(3)].is_alive = 0;
+	check(whatif_output(1, 3, "1", output, sizeof(output)) < 0, "whatif rejects links to dead neighbors", NULL);
+}
+
+/* costs saturate at infinity instead of wrapping, and -m lowers infinity for the routes and the wire */
+static void test_metric_infinity(){
+	metric_t row_2[] = {10, 0, 6};
+
+	check(metric_add(METRIC_MAX - 1, METRIC_MAX - 1) == metric_infinity && metric_add(metric_infinity - 1, 5) == metric_infinity,
+		"metric_add saturates", NULL);
+	metric_infinity = 16;
+	check(metric_add(10, 5) == 15 && metric_add(10, 6) == 16 && metric_from_wire(20) == 16 && metric_to_wire(16) == WIRE_INFINITY
+		&& metric_to_wire(15) == 15, "metric_add and the wire respect -m", NULL);
+	if(load_topology(3, "1 2 10\n") == 1){
+		set_row(2, row_2);
+		bellman_ford();
+		check(servers[server_index(3)].cost == 16 && servers[server_index(3)].num_of_next_hops == 0, "route at -m infinity unreachable", NULL);
+	}
+	free_tables();
+	metric_infinity = METRIC_MAX;
+}
+
+/* longest prefix match of the trie against a linear search of the prefix list */
+static void test_fib_longest_match(){
+	struct fib f;
+	uint32_t addr, mask;
+	int i, k, len, expected, best_len, mismatches = 0, hits = 0;
+	char detail[128];
+
+	srand(7);
+	memset(&f, 0, sizeof(f));
+	fib_init(&f, 64);
+	for(i = 0; i < 500; i++){
+		len = i < 100 ? 25 + rand() % 8 : 12 + rand() % 21; // the lengths of every trie level, no cover of all of 10/8
+		addr = (10u << 24) | (rand() % 4) << 16 | (rand() & 0xffff);
+		fib_add_prefix(&f, addr, len, rand() % 64);
+		for(k = 0; k < f.num_of_prefixes - 1; k++){ // one dest per prefix
+			if(f.prefixes[k].prefix == f.prefixes[f.num_of_prefixes - 1].prefix && f.prefixes[k].len == len){
+				f.num_of_prefixes--;
+				break;
+			}
+		}
+	}
+	fib_rebuild(&f);
+	for(i = 0; i < 100000; i++){
+		addr = i % 2 ? f.prefixes[rand() % f.num_of_prefixes].prefix ^ (rand() & 0xff) : (10u << 24) | (rand() % 32) << 16 | (rand() & 0xffff);
+		expected = -1;
+		best_len = -1;
+		for(k = 0; k < f.num_of_prefixes; k++){
+			mask = f.prefixes[k].len == 0 ? 0 : 0xffffffffu << (32 - f.prefixes[k].len);
+			if((addr & mask) == f.prefixes[k].prefix && f.prefixes[k].len > best_len){
+				best_len = f.prefixes[k].len;
+				expected = f.prefixes[k].dest;
+			}
+		}
+		hits += expected >= 0;
+		mismatches += fib_lookup_dest(&f, addr) != expected;
+	}
+	sprintf(detail, "%d of 100000 lookups differ", mismatches);
+	check(mismatches == 0 && hits > 0 && hits < 100000, "fib longest prefix match", detail);
+	fib_free(&f);
+}
+
+int main(int argc, char** argv){
+	quiet = 1;
+	requested_id = 1;
+
+	test_round_trip(0);
+	test_round_trip(1);
+	test_bellman_ford_ecmp();
+	test_bellman_ford_link_cost();
+	test_bellman_ford_cost_increase();
+	test_prefix_withdrawal();
+	test_dead_neighbor();
+	test_selective_acks();
+	test_route_damping();
+	test_hellos();
+	test_reliable_updates();
+	test_unchanged_vectors();
+	test_loop_free_alternates();
+	test_restart_window();
+	test_areas();
+	test_rx_shard_merge();
+	test_whatif();
+	test_metric_infinity();
+	test_fib_longest_match();
+
+	free_tables();
+	printf("%d checks failed\n", failures);
+	return failures;
+}
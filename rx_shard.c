@@ -0,0 +1,416 @@
+/*
+*
+* 	Receive sharding
+*
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+
+#include "router.h"
+#include "rx_shard.h"
+
+/* latest vector of one neighbor not merged yet */
+struct rx_slot{
+	pthread_mutex_t lock;
+	metric_t *row; // the neighbor's decoded vector, NULL for servers that are not neighbors
+	uint8_t *tlvs; // copy of the TLVs of the latest vector
+	int tlv_len;
+	int tlv_size;
+	int compact;
+	int pending; // vectors decoded since the last merge
+	uint64_t seq; // arrival of the latest vector
+	unsigned long bytes;
+	int64_t start_ns; // when the first pending vector was read
+};
+
+/* a packet other than a vector, merged as received */
+struct rx_queued{
+	struct rx_queued *next;
+	uint64_t seq; // arrival, ordered against the slots' vectors
+	int len;
+	char data[];
+};
+
+/* a socket read by its own thread */
+struct rx_shard{
+	pthread_t thread;
+	int sock;
+	uint32_t dropped; // SO_RXQ_OVFL counter of sock
+	unsigned long processed; // datagrams read, moved to interval_stats by the merge
+};
+
+int rx_shards=1;
+int rx_wake_fd=-1;
+
+static struct rx_shard shards[RX_SHARDS_MAX];
+static struct rx_slot *slots;
+static int wake_pipe[2];
+static int wake_pending;
+static pthread_mutex_t queue_lock=PTHREAD_MUTEX_INITIALIZER;
+static struct rx_queued *queue_head,*queue_tail;
+static int queue_len;
+static unsigned long merges,vectors_merged,vectors_coalesced,queue_drops;
+static int stopping;
+static uint64_t arrivals;
+
+/*
+*
+*	Makes rx_wake_fd readable, once until the next merge
+*
+*/
+static void wake_merger(){
+	char byte=1;
+
+	if(__sync_lock_test_and_set(&wake_pending,1)==0)
+		write(wake_pipe[1],&byte,1);
+}
+
+/*
+*
+*	Queues a copy of a packet other than a vector for the merge, dropping it when the queue is full
+*
+*/
+static void enqueue(void *packet,int pkt_len){
+	struct rx_queued *queued=(struct rx_queued*)malloc(sizeof(struct rx_queued)+pkt_len);
+
+	if(queued==NULL)
+		return;
+	queued->next=NULL;
+	queued->len=pkt_len;
+	memcpy(queued->data,packet,pkt_len);
+
+	pthread_mutex_lock(&queue_lock);
+	if(queue_len==RX_QUEUE_MAX){
+		pthread_mutex_unlock(&queue_lock);
+		free(queued);
+		__sync_add_and_fetch(&queue_drops,1);
+		return;
+	}
+	queued->seq=__sync_add_and_fetch(&arrivals,1);
+	if(queue_tail==NULL)
+		queue_head=queued;
+	else
+		queue_tail->next=queued;
+	queue_tail=queued;
+	queue_len++;
+	pthread_mutex_unlock(&queue_lock);
+}
+
+/*
+*
+*	Decodes a distance vector into its sender's slot, or queues any other packet for
+*	the merge. Called by the thread that read the packet.
+*
+*/
+void rx_shard_stage(void *packet,int pkt_len){
+	int sender=pkt_sender(packet,pkt_len),compact,changed=0;
+	struct rx_slot *slot;
+	uint8_t *tlvs;
+	int64_t start_ns=event_tracing ? event_clock_ns() : 0;
+
+	if(sender<0 || slots[sender].row==NULL){ // not a vector, or one the merge discards
+		enqueue(packet,pkt_len);
+		wake_merger();
+		return;
+	}
+
+	slot=&slots[sender];
+	compact=((uint8_t*)packet)[0]==PKT_MAGIC;
+	pthread_mutex_lock(&slot->lock);
+	tlvs=compact ? decode_compact_pkt(packet,pkt_len,slot->row,&changed) : decode_pkt(packet,pkt_len,sender,slot->row,&changed);
+	if(tlvs==NULL){ // malformed, the merge reports it like any other
+		pthread_mutex_unlock(&slot->lock);
+		enqueue(packet,pkt_len);
+		wake_merger();
+		return;
+	}
+	slot->tlv_len=(uint8_t*)packet+pkt_len-tlvs;
+	if(slot->tlv_len>slot->tlv_size){
+		slot->tlvs=(uint8_t*)realloc(slot->tlvs,slot->tlv_len);
+		slot->tlv_size=slot->tlv_len;
+	}
+	memcpy(slot->tlvs,tlvs,slot->tlv_len);
+	slot->compact=compact;
+	slot->seq=__sync_add_and_fetch(&arrivals,1);
+	if(slot->pending++==0)
+		slot->start_ns=start_ns;
+	slot->bytes+=pkt_len;
+	pthread_mutex_unlock(&slot->lock);
+	wake_merger();
+}
+
+/*
+*
+*	Shard thread: reads its socket and stages every packet until rx_shard_stop()
+*
+*/
+static void *shard_main(void *arg){
+	struct rx_shard *shard=(struct rx_shard*)arg;
+	char recv_buf[MAX_PKT_SIZE];
+	char control[CMSG_SPACE(sizeof(uint32_t))];
+	struct sockaddr_in src_ip_struct;
+	struct iovec iov={recv_buf,sizeof(recv_buf)};
+	struct msghdr recv_msg;
+	struct cmsghdr *cmsg;
+	uint32_t dropped;
+	int recv_len;
+
+	while(1){
+		memset(&recv_msg,0,sizeof(recv_msg));
+		recv_msg.msg_name=&src_ip_struct;
+		recv_msg.msg_namelen=sizeof(src_ip_struct);
+		recv_msg.msg_iov=&iov;
+		recv_msg.msg_iovlen=1;
+		recv_msg.msg_control=control;
+		recv_msg.msg_controllen=sizeof(control);
+		recv_len=recvmsg(shard->sock,&recv_msg,0);
+		if(__atomic_load_n(&stopping,__ATOMIC_ACQUIRE))
+			break;
+		if(recv_len<0){
+			perror("shard recv");
+			continue;
+		}
+		for(cmsg=CMSG_FIRSTHDR(&recv_msg);cmsg!=NULL;cmsg=CMSG_NXTHDR(&recv_msg,cmsg)){
+			if(cmsg->cmsg_level==SOL_SOCKET && cmsg->cmsg_type==SO_RXQ_OVFL){
+				memcpy(&dropped,CMSG_DATA(cmsg),sizeof(uint32_t));
+				__atomic_store_n(&shard->dropped,dropped,__ATOMIC_RELAXED);
+			}
+		}
+		__sync_add_and_fetch(&shard->processed,1);
+		if(capture_file!=NULL)
+			capture_pkt(recv_buf,recv_len,&src_ip_struct);
+		rx_shard_stage(recv_buf,recv_len);
+	}
+	return NULL;
+}
+
+/*
+*
+*	Opens rx_shards-1 more sockets on addr, which my_socket must have been bound to
+*	with SO_REUSEPORT, and starts a thread per socket. Call after parse_topology_file().
+*
+*	@return
+*		Integer indicating success/failure of function
+*
+*/
+int rx_shard_start(struct sockaddr_in *addr){
+	int i,optval=1;
+
+	if(rx_shards>RX_SHARDS_MAX)
+		rx_shards=RX_SHARDS_MAX;
+	slots=(struct rx_slot*)calloc(num_of_servers,sizeof(struct rx_slot));
+	if(slots==NULL || pipe(wake_pipe)<0){
+		perror("receive shards");
+		return -1;
+	}
+	fcntl(wake_pipe[0],F_SETFL,O_NONBLOCK);
+	rx_wake_fd=wake_pipe[0];
+	for(i=0;i<num_of_servers;i++){
+		pthread_mutex_init(&slots[i].lock,NULL);
+		if(servers[i].link_cost==metric_infinity) // only neighbors' vectors are kept
+			continue;
+		slots[i].row=(metric_t*)malloc(sizeof(metric_t)*num_of_servers);
+		memcpy(slots[i].row,adj_matrix[i],sizeof(metric_t)*num_of_servers);
+	}
+
+	for(i=1;i<rx_shards;i++){
+		shards[i].sock=socket(AF_INET,SOCK_DGRAM,0);
+		if(shards[i].sock<0){
+			perror("shard socket");
+			return -1;
+		}
+		setsockopt(shards[i].sock,SOL_SOCKET,SO_REUSEPORT,&optval,sizeof(int));
+		setsockopt(shards[i].sock,SOL_SOCKET,SO_RXQ_OVFL,&optval,sizeof(int));
+		if(bind(shards[i].sock,(struct sockaddr*)addr,sizeof(struct sockaddr_in))<0){
+			perror("shard bind");
+			return -1;
+		}
+		pthread_create(&shards[i].thread,NULL,shard_main,&shards[i]);
+	}
+	return 1;
+}
+
+/*
+*
+*	Stops the shard threads, before the capture file and event trace are closed
+*
+*/
+void rx_shard_stop(){
+	int i;
+
+	__atomic_store_n(&stopping,1,__ATOMIC_RELEASE);
+	for(i=1;i<rx_shards;i++){
+		shutdown(shards[i].sock,SHUT_RDWR); // wakes the blocked recvmsg()
+		pthread_join(shards[i].thread,NULL);
+		close(shards[i].sock);
+	}
+	rx_shards=1;
+}
+
+/*
+*
+*	Takes the vector pending in slot index into adj_matrix and processes its TLVs
+*
+*	@return
+*		1 if routes have to be recomputed
+*
+*/
+static int merge_slot(int index){
+	struct rx_slot *slot=&slots[index];
+	int j,pending,recompute;
+	unsigned long bytes;
+	int64_t start_ns;
+	metric_t *row=adj_matrix[index];
+
+	pthread_mutex_lock(&slot->lock);
+	if(slot->pending==0){
+		pthread_mutex_unlock(&slot->lock);
+		return 0;
+	}
+	pending=slot->pending;
+	bytes=slot->bytes;
+	start_ns=slot->start_ns;
+	entries_changed=0;
+	for(j=0;j<num_of_servers;j++){
+		if(row[j]!=slot->row[j]){
+			row[j]=slot->row[j];
+			entries_changed++;
+		}
+	}
+	vector_received(index,slot->compact);
+	process_tlvs(servers[index].server_id,slot->tlvs,slot->tlvs+slot->tlv_len);
+	slot->pending=0;
+	slot->bytes=0;
+	pthread_mutex_unlock(&slot->lock);
+
+	vectors_merged++;
+	vectors_coalesced+=pending-1;
+	recompute=accept_vector(index,bytes,start_ns);
+	schedule_ack(index);
+	return recompute;
+}
+
+/*
+*
+*	Returns the arrival of the vector pending in slot index, 0 if there is none
+*
+*/
+static uint64_t slot_pending_seq(int index){
+	uint64_t seq;
+
+	pthread_mutex_lock(&slots[index].lock);
+	seq=slots[index].pending ? slots[index].seq : 0;
+	pthread_mutex_unlock(&slots[index].lock);
+	return seq;
+}
+
+/*
+*
+*	Returns the index of the server a queued packet came from, -1 if unknown
+*
+*/
+static int queued_sender(struct rx_queued *queued){
+	uint16_t sender_id;
+
+	if(queued->len>=4 && (uint8_t)queued->data[0]==PKT_MAGIC){
+		memcpy(&sender_id,queued->data+2,2);
+		return server_index(ntohs(sender_id));
+	}
+	return pkt_sender(queued->data,queued->len);
+}
+
+/*
+*
+*	Merges what the shards received in arrival order per neighbor: a queued packet
+*	goes after the neighbor's pending vector if that came first, and a keepalive
+*	that came before it is superseded by it. The remaining slots are merged in server
+*	order and routes are recomputed once if any vector was accepted. Called by the
+*	main loop when rx_wake_fd is readable.
+*
+*/
+void rx_shard_merge(){
+	struct rx_queued *queued,*next;
+	char drain[64];
+	int i,sender,recompute=0,left;
+	uint64_t seq;
+
+	// drain before releasing wake_pending, or a wake written in between is lost with it
+	while(read(wake_pipe[0],drain,sizeof(drain))>0)
+		;
+	__sync_lock_release(&wake_pending);
+	__sync_synchronize();
+	for(i=1;i<rx_shards;i++)
+		interval_stats.pkts_processed+=__sync_fetch_and_and(&shards[i].processed,0);
+
+	pthread_mutex_lock(&queue_lock);
+	queued=queue_head;
+	queue_head=queue_tail=NULL;
+	queue_len=0;
+	pthread_mutex_unlock(&queue_lock);
+	for(;queued!=NULL;queued=next){
+		next=queued->next;
+		sender=queued_sender(queued);
+		seq=sender>=0 && slots[sender].row!=NULL ? slot_pending_seq(sender) : 0;
+		if(seq!=0 && seq<queued->seq)
+			recompute|=merge_slot(sender);
+		else if(seq>queued->seq && (uint8_t)queued->data[0]==PKT_MAGIC && (uint8_t)queued->data[1]==PKT_UNCHANGED){
+			free(queued);
+			continue;
+		}
+		deserialize_pkt(queued->data,queued->len);
+		free(queued);
+	}
+
+	for(i=0;i<num_of_servers;i++){
+		if(slots[i].row!=NULL)
+			recompute|=merge_slot(i);
+	}
+
+	if(recompute){
+		merges++;
+		bellman_ford();
+		event_cause=0;
+	}
+
+	// wake again if a stage raced the release above and was not merged
+	pthread_mutex_lock(&queue_lock);
+	left=queue_len;
+	pthread_mutex_unlock(&queue_lock);
+	for(i=0;i<num_of_servers && left==0;i++){
+		if(slots[i].row!=NULL && slot_pending_seq(i)!=0)
+			left=1;
+	}
+	if(left)
+		wake_merger();
+}
+
+/*
+*
+*	Returns the kernel drops on the shards' own sockets, my_socket's are in rx_dropped
+*
+*/
+uint32_t rx_shard_dropped(){
+	uint32_t dropped=0;
+	int i;
+
+	for(i=1;i<rx_shards;i++)
+		dropped+=__atomic_load_n(&shards[i].dropped,__ATOMIC_RELAXED);
+	return dropped;
+}
+
+/*
+*
+*	Prints the merge counters
+*
+*/
+void rx_shard_report(){
+	printf("Receive shards: %d sockets, %lu recomputes for %lu vectors merged, %lu coalesced, %lu queue drops\n",
+		rx_shards,merges,vectors_merged,vectors_coalesced,queue_drops);
+}
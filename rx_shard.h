@@ -0,0 +1,36 @@
+/*
+*
+* 	Receive sharding
+*
+* 	With -R <n> the server binds n SO_REUSEPORT sockets to its port: my_socket,
+* 	still read by the main loop, and n-1 sockets read by threads of their own.
+* 	The kernel hashes each neighbor's address to one socket, so a neighbor is
+* 	always read by the same thread. Distance vectors are decoded by the thread
+* 	that reads them into a slot per neighbor, where a newer vector replaces one
+* 	not merged yet; other packets are queued as they are. The main thread merges
+* 	the queue, keeping each neighbor's packets in arrival order against its
+* 	vector, then the other slots in server order, and recomputes routes once per
+* 	merge, so routes depend only on the vectors merged, not on thread timing.
+*
+*/
+
+#ifndef RX_SHARD_H
+#define RX_SHARD_H
+
+#include <stdint.h>
+#include <netinet/in.h>
+
+#define RX_SHARDS_MAX 64
+#define RX_QUEUE_MAX 4096 // packets other than vectors waiting for the merge
+
+extern int rx_shards; // -R, 1 reads my_socket in the main loop only
+extern int rx_wake_fd; // readable when there is something to merge
+
+int rx_shard_start(struct sockaddr_in *addr);
+void rx_shard_stage(void *packet,int pkt_len);
+void rx_shard_merge();
+void rx_shard_stop();
+uint32_t rx_shard_dropped();
+void rx_shard_report();
+
+#endif